@@ -1,8 +1,16 @@
 #pragma once
 
+#include <chrono>
+#include "containers.h"
 #include "exotics.h"
 #include <functional>
+#include <mutex>
+#include <new>
+#include "NumArray.h"
+#include <set>
+#include <string>
 #include <tuple>
+#include <utility>
 
 namespace sel {
 struct BaseFun {
@@ -14,19 +22,140 @@ namespace detail {
 
 inline int _lua_dispatcher(lua_State *l) {
     BaseFun *fun = (BaseFun *)lua_touserdata(l, lua_upvalueindex(1));
+#ifdef SELENE_INSTRUMENT
+    using Clock = std::chrono::steady_clock;
+    CallStats *stats = (CallStats *)lua_touserdata(l, lua_upvalueindex(2));
+    Clock::time_point start = Clock::now();
+    int ret = fun->Apply();
+    stats->Record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      Clock::now() - start).count());
+    return ret;
+#else
     return fun->Apply();
+#endif
+}
+
+// Pushes a closure calling the BaseFun on top of the stack, held as
+// light or full userdata, through the dispatcher. The label names the
+// binding in instrumentation snapshots.
+inline void _push_dispatcher(const detail::StateBlock &state,
+                             const std::string &label) {
+#ifdef SELENE_INSTRUMENT
+    lua_pushlightuserdata(state.GetState(),
+                          state.GetInstrumentation().Get(label));
+    lua_pushcclosure(state.GetState(), &_lua_dispatcher, 2);
+#else
+    (void)label;
+    lua_pushcclosure(state.GetState(), &_lua_dispatcher, 1);
+#endif
+}
+
+// Pushes a closure calling fun, which is owned elsewhere
+inline void _push_dispatcher(const detail::StateBlock &state, BaseFun *fun,
+                             const std::string &label) {
+    lua_pushlightuserdata(state.GetState(), (void *)fun);
+    _push_dispatcher(state, label);
+}
+
+inline int _fun_gc(lua_State *l) {
+    static_cast<BaseFun *>(lua_touserdata(l, 1))->~BaseFun();
+    return 0;
+}
+
+// Constructs a F in a new full userdata and pushes a closure calling
+// it. The closure owns the userdata, so F is destroyed when Lua
+// collects the closure.
+template <typename F, typename... Args>
+inline F *_push_owned_fun(const detail::StateBlock &state,
+                            const std::string &label, Args&&... args) {
+    lua_State *l = state.GetState();
+    void *addr = lua_newuserdata(l, sizeof(F));
+    F *fun = new(addr) F(std::forward<Args>(args)...);
+    if (luaL_newmetatable(l, "sel_fun")) {
+        lua_pushcfunction(l, &_fun_gc);
+        lua_setfield(l, -2, "__gc");
+    }
+    lua_setmetatable(l, -2);
+    _push_dispatcher(state, label);
+    return fun;
+}
+
+#ifdef SELENE_INSTRUMENT
+// Times a statically bound function, whose stats slot follows its nup
+// own upvalues
+template <lua_CFunction fun, int nup>
+int _timed_static(lua_State *l) {
+    using Clock = std::chrono::steady_clock;
+    CallStats *stats = (CallStats *)lua_touserdata(l, lua_upvalueindex(nup + 1));
+    Clock::time_point start = Clock::now();
+    int ret = fun(l);
+    stats->Record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      Clock::now() - start).count());
+    return ret;
+}
+#endif
+
+// The lua_CFunctions of statically bound functions, which unlike the
+// dispatcher each have their own. Shared by all states, since the same
+// function binds the same way in any of them.
+struct _static_funs {
+    std::mutex mutex;
+    std::set<lua_CFunction> funs;
+
+    static _static_funs &Get() {
+        static _static_funs instance;
+        return instance;
+    }
+
+    // Always true, so it can initialize a static once per function
+    bool Add(lua_CFunction fun) {
+        std::lock_guard<std::mutex> lock(mutex);
+        funs.insert(fun);
+        return true;
+    }
+
+    bool Has(lua_CFunction fun) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return funs.count(fun) != 0;
+    }
+};
+
+// Whether the function on top of the stack was bound through Selene
+inline bool _is_binding(lua_State *l) {
+    if (!lua_iscfunction(l, -1)) return false;
+    lua_CFunction fun = lua_tocfunction(l, -1);
+    return fun == &_lua_dispatcher || _static_funs::Get().Has(fun);
+}
+
+// Pushes a closure of a statically bound function over the nup values
+// on top of the stack. The label names the binding in instrumentation
+// snapshots.
+template <lua_CFunction fun, int nup>
+inline void _push_static(const detail::StateBlock &state,
+                         const std::string &label) {
+#ifdef SELENE_INSTRUMENT
+    static const bool marked = _static_funs::Get().Add(&_timed_static<fun, nup>);
+    lua_pushlightuserdata(state.GetState(),
+                          state.GetInstrumentation().Get(label));
+    lua_pushcclosure(state.GetState(), &_timed_static<fun, nup>, nup + 1);
+#else
+    static const bool marked = _static_funs::Get().Add(fun);
+    (void)label;
+    lua_pushcclosure(state.GetState(), fun, nup);
+#endif
+    (void)marked;
 }
 
 template <typename Ret, typename... Args, std::size_t... N>
-inline Ret _lift(std::function<Ret(Args...)> fun,
-                 std::tuple<Args...> args,
+inline Ret _lift(const std::function<Ret(Args...)> &fun,
+                 std::tuple<Args...> &args,
                  _indices<N...>) {
     return fun(std::get<N>(args)...);
 }
 
 template <typename Ret, typename... Args>
-inline Ret _lift(std::function<Ret(Args...)> fun,
-                 std::tuple<Args...> args) {
+inline Ret _lift(const std::function<Ret(Args...)> &fun,
+                 std::tuple<Args...> &args) {
     return _lift(fun, args, typename _indices_builder<sizeof...(Args)>::type());
 }
 
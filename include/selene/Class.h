@@ -1,11 +1,18 @@
 #pragma once
 
 #include "ClassFun.h"
+#include <cstring>
 #include "Ctor.h"
 #include "Dtor.h"
 #include "MetatableRegistry.h"
 #include <map>
 #include <memory>
+#include "Operators.h"
+#include "PropertyTable.h"
+#include "StaticMember.h"
+#include <stdexcept>
+#include <string>
+#include <typeinfo>
 #include <vector>
 #include <stack>
 
@@ -13,6 +20,39 @@ namespace sel {
 
 struct BaseClass {
     virtual ~BaseClass() {}
+    virtual const detail::BasePool *GetPool() const {
+        return nullptr;
+    }
+};
+
+/*
+ * Declares the base classes of a class, ahead of its members:
+ *
+ *     state["Derived"].SetClass<Derived>(sel::Bases<Base>{},
+ *                                        "extra", &Derived::Extra);
+ *
+ * The bases must already be registered. Their methods and properties
+ * are copied into the metatable of the derived class, so lookups stay a
+ * single table access however deep the hierarchy. Inherited members
+ * receive the object adjusted to their own class.
+ */
+template <typename... B>
+struct Bases {};
+
+/*
+ * Allocates the instances constructed by Lua from a pool of slabs,
+ * each holding objects_per_slab objects, instead of the Lua heap:
+ *
+ *     state["Particle"].SetClass<Particle, double>(sel::Pooled{},
+ *                                                  "x", &Particle::x);
+ *
+ * The userdata holds only a pointer to the object and __gc returns it
+ * to the pool. See State::GetPoolStats.
+ */
+struct Pooled {
+    std::size_t objects_per_slab;
+    explicit Pooled(std::size_t objects_per_slab = 64)
+        : objects_per_slab(objects_per_slab) {}
 };
 
 
@@ -23,19 +63,28 @@ class Class : public BaseClass {
 private:
     bool _should_erase = true;
     std::string _name;
-    std::string _metatable_name;
+    // Held by pointer so that bindings can refer to it across moves
+    std::unique_ptr<detail::Metatable> _metatable;
+    std::unique_ptr<detail::PropertyTable> _properties;
+    std::vector<std::unique_ptr<detail::Upcast>> _upcasts;
+    std::unique_ptr<detail::ObjectPool<T>> _pool;
     std::unique_ptr<A> _ctor;
     std::unique_ptr<Dtor<T>> _dtor;
     using Funs = std::vector<std::unique_ptr<BaseFun>>;
     Funs _funs;
     MetatableRegistry& _meta_registry;
 
+    // Names a method in instrumentation snapshots
+    std::string _label(const std::string &member_name) const {
+        return _name + ":" + member_name;
+    }
+
     void _register_ctor(const detail::StateBlock &state) {
-        _ctor.reset(new A(state, _metatable_name.c_str()));
+        _ctor.reset(new A(state, *_metatable, _name + ".new"));
     }
 
     void _register_dtor(const detail::StateBlock &state) {
-        _dtor.reset(new Dtor<T>(state, _metatable_name.c_str()));
+        _dtor.reset(new Dtor<T>(state, *_metatable, _name + ".__gc"));
     }
 
     template <typename M>
@@ -56,7 +105,8 @@ private:
         };
         _funs.emplace_back(
             new ClassFun<1, T, M>
-            {state, std::string{member_name}, _metatable_name.c_str(), lambda_get});
+            {state, std::string{member_name}, *_metatable,
+                    _label(member_name), lambda_get});
 
         std::function<void(T*, M)> lambda_set = [member](T *t, M value) {
             (t->*member) = value;
@@ -64,7 +114,8 @@ private:
         _funs.emplace_back(
             new ClassFun<0, T, void, M>
             {state, std::string("set_") + member_name,
-                    _metatable_name.c_str(), lambda_set});
+                    *_metatable,
+                    _label(std::string("set_") + member_name), lambda_set});
     }
 
     template <typename M>
@@ -78,7 +129,7 @@ private:
         _funs.emplace_back(
             new ClassFun<1, T, M>
             {state, std::string{member_name},
-                    _metatable_name.c_str(), lambda_get});
+                    *_metatable, _label(member_name), lambda_get});
     }
 
     template <typename Ret, typename... Args>
@@ -91,7 +142,8 @@ private:
         constexpr int arity = detail::_arity<Ret>::value;
         _funs.emplace_back(
             new ClassFun<arity, T, Ret, Args...>
-            {state, std::string(fun_name), _metatable_name.c_str(), lambda});
+            {state, std::string(fun_name), *_metatable,
+                    _label(fun_name), lambda});
     }
 
     template <typename Ret, typename... Args>
@@ -104,7 +156,8 @@ private:
         constexpr int arity = detail::_arity<Ret>::value;
         _funs.emplace_back(
             new ClassFun<arity, T, Ret, Args...>
-            {state, std::string(fun_name), _metatable_name.c_str(), lambda});
+            {state, std::string(fun_name), *_metatable,
+                    _label(fun_name), lambda});
     }
 
     template <typename Ret, typename... Args>
@@ -118,11 +171,212 @@ private:
         constexpr int arity = detail::_arity<Ret>::value;
         _funs.emplace_back(
             new ClassFun<arity, const T, Ret, Args...>
-            {state, std::string(fun_name), _metatable_name.c_str(), lambda});
+            {state, std::string(fun_name), *_metatable,
+                    _label(fun_name), lambda});
+    }
+
+    // Sets a statically bound member in the metatable. Its upvalues are
+    // the StateBlock and the Metatable.
+    template <lua_CFunction fun>
+    void _register_static(const detail::StateBlock &state,
+                          const std::string &name) {
+        lua_State *l = state.GetState();
+        lua_pushlightuserdata(l, const_cast<detail::StateBlock *>(&state));
+        lua_pushlightuserdata(l, _metatable.get());
+        detail::_push_static<fun, 2>(state, _label(name));
+        lua_setfield(l, -2, name.c_str());
+    }
+
+    template <typename F, F f>
+    void _register_member(const detail::StateBlock &state,
+                          const char *fun_name,
+                          Method<F, f>) {
+        _register_static<&detail::_method<detail::_class_self, F, f>::Call>(
+            state, fun_name);
+    }
+
+    template <typename F, F f>
+    void _register_member(const detail::StateBlock &state,
+                          const char *member_name,
+                          Field<F, f>) {
+        using field = detail::_field<detail::_class_self, F, f>;
+        _register_static<&field::Get>(state, member_name);
+        _register_setter<field>(state, member_name,
+                                typename field::Settable{});
+    }
+
+    template <typename F, F f>
+    void _register_member(const detail::StateBlock &,
+                          const char *member_name,
+                          Property<F, f>) {
+        using property = detail::_property<F, f>;
+        _properties->Add(member_name, &property::Get, property::Setter());
+    }
+
+    // Classes with properties index through the PropertyTable; the
+    // others index the metatable directly
+    void _register_index(const detail::StateBlock &state) {
+        lua_State *l = state.GetState();
+        if (_properties->Empty()) {
+            lua_pushvalue(l, -1);
+            lua_setfield(l, -2, "__index");
+            return;
+        }
+        _properties->Build();
+        lua_pushlightuserdata(l, _properties.get());
+        lua_pushvalue(l, -2);
+        lua_pushcclosure(l, &detail::_property_index, 2);
+        lua_setfield(l, -2, "__index");
+        lua_pushlightuserdata(l, _properties.get());
+        lua_pushcclosure(l, &detail::_property_newindex, 1);
+        lua_setfield(l, -2, "__newindex");
+    }
+
+    template <typename field>
+    void _register_setter(const detail::StateBlock &state,
+                          const char *member_name,
+                          std::true_type) {
+        _register_static<&field::Set>(state, std::string("set_") + member_name);
+    }
+
+    template <typename field>
+    void _register_setter(const detail::StateBlock &, const char *,
+                          std::false_type) {}
+
+    const detail::Upcast *_new_upcast(void *(*cast)(void *),
+                                      const detail::Upcast *next) {
+        _upcasts.emplace_back(new detail::Upcast{cast, next});
+        return _upcasts.back().get();
+    }
+
+    // Copies the members of B into the metatable on top of the stack,
+    // keeping those already there. Upcasts of B to its own bases are
+    // chained behind the upcast to B.
+    template <typename B>
+    void _inherit(const detail::StateBlock &state) {
+        static_assert(std::is_base_of<B, T>::value,
+                      "Bases must be base classes of the registered class");
+        const detail::Metatable *base = _meta_registry.Find(typeid(B));
+        void *(*cast)(void *) = &detail::_upcast_to<T, B>;
+        lua_State *l = state.GetState();
+        lua_pushlightuserdata(l, const_cast<detail::Metatable *>(base));
+        lua_pushlightuserdata(l, const_cast<detail::Upcast *>(
+                                     _new_upcast(cast, nullptr)));
+        lua_rawset(l, -3);
+        lua_rawgeti(l, LUA_REGISTRYINDEX, base->ref);
+        lua_pushnil(l);
+        while (lua_next(l, -2)) {
+            // Upcasts are the light userdata values; the header mark and
+            // the Share are already set on this metatable and are kept
+            if (lua_islightuserdata(l, -2) && lua_islightuserdata(l, -1) &&
+                lua_touserdata(l, -2) != detail::_share_key()) {
+                auto *next = static_cast<const detail::Upcast *>(
+                    lua_touserdata(l, -1));
+                lua_pop(l, 1);
+                lua_pushlightuserdata(l, const_cast<detail::Upcast *>(
+                                             _new_upcast(cast, next)));
+            }
+            const char *key = lua_type(l, -2) == LUA_TSTRING
+                ? lua_tostring(l, -2) : nullptr;
+            lua_pushvalue(l, -2);
+            lua_rawget(l, -5);
+            const bool keep = !lua_isnil(l, -1) || (key != nullptr &&
+                (std::strcmp(key, "__index") == 0 ||
+                 std::strcmp(key, "__newindex") == 0));
+            lua_pop(l, 1);
+            if (keep) {
+                lua_pop(l, 1);
+            } else {
+                lua_pushvalue(l, -2);
+                lua_insert(l, -2);
+                lua_rawset(l, -5);
+            }
+        }
+        lua_pop(l, 1);
+        if (base->properties == nullptr) return;
+        for (const auto &entry : base->properties->Entries()) {
+            if (_properties->Has(entry.name)) continue;
+            _properties->Add(entry.name, entry.get, entry.set,
+                             _new_upcast(cast, entry.upcast));
+        }
+    }
+
+    // Bases are looked up before anything is registered, so that a
+    // missing one leaves no half-built class behind
+    template <typename B>
+    void _check_base() {
+        if (_meta_registry.Find(typeid(B)) == nullptr) {
+            throw std::runtime_error(_name + ": base class " + typeid(B).name() +
+                                     " is not registered");
+        }
+    }
+
+    void _check_bases() {}
+
+    template <typename... B, typename... Ms>
+    void _check_bases(Bases<B...>, Ms... members) {
+        int check[] = {0, (_check_base<B>(), 0)...};
+        (void)check;
+        _check_bases(members...);
+    }
+
+    template <typename M, typename... Ms>
+    void _check_bases(M, Ms... members) {
+        _check_bases(members...);
+    }
+
+    template <typename Op>
+    void _register_operator(const detail::StateBlock &state, std::true_type) {
+        _register_static<&Op::Call>(state, Op::Name());
+    }
+
+    template <typename Op>
+    void _register_operator(const detail::StateBlock &, std::false_type) {}
+
+    template <typename Op>
+    void _register_operator(const detail::StateBlock &state) {
+        _register_operator<Op>(state, typename Op::Defined{});
     }
 
     void _register_members(const detail::StateBlock &state) {}
 
+    template <typename... Ms>
+    void _register_members(const detail::StateBlock &state,
+                           Operators,
+                           Ms... members) {
+        _register_operator<detail::_binary_op<T, detail::_op_add>>(state);
+        _register_operator<detail::_binary_op<T, detail::_op_sub>>(state);
+        _register_operator<detail::_binary_op<T, detail::_op_mul>>(state);
+        _register_operator<detail::_binary_op<T, detail::_op_div>>(state);
+        _register_operator<detail::_binary_op<T, detail::_op_mod>>(state);
+        _register_operator<detail::_binary_op<T, detail::_op_eq>>(state);
+        _register_operator<detail::_binary_op<T, detail::_op_lt>>(state);
+        _register_operator<detail::_binary_op<T, detail::_op_le>>(state);
+        _register_operator<detail::_unm_op<T>>(state);
+        _register_operator<detail::_len_op<T>>(state);
+        _register_operator<detail::_tostring_op<T>>(state);
+        _register_operator<detail::_call_op<T>>(state);
+        _register_members(state, members...);
+    }
+
+    template <typename... Ms>
+    void _register_members(const detail::StateBlock &state,
+                           Pooled pooled,
+                           Ms... members) {
+        _pool.reset(new detail::ObjectPool<T>(_name, pooled.objects_per_slab));
+        _ctor->UsePool(_pool.get());
+        _register_members(state, members...);
+    }
+
+    template <typename... B, typename... Ms>
+    void _register_members(const detail::StateBlock &state,
+                           Bases<B...>,
+                           Ms... members) {
+        int inherit[] = {0, (_inherit<B>(state), 0)...};
+        (void)inherit;
+        _register_members(state, members...);
+    }
+
     template <typename M, typename... Ms>
     void _register_members(const detail::StateBlock &state,
                            const char *name,
@@ -136,25 +390,42 @@ public:
     Class(const detail::StateBlock &state,
           MetatableRegistry &meta_registry,
           const std::string &name,
-          Members... members) : _name(name), _meta_registry(meta_registry) {
-        _metatable_name = _name + "_lib";
-        _meta_registry.Insert(typeid(T), _metatable_name);
-        luaL_newmetatable(state.GetState(), _metatable_name.c_str());
+          Members... members)
+        : _name(name),
+          _metatable(new detail::Metatable{name + "_lib", LUA_NOREF,
+                                           nullptr, nullptr}),
+          _properties(new detail::PropertyTable(state, *_metatable)),
+          _meta_registry(meta_registry) {
+        _check_bases(members...);
+        _metatable->properties = _properties.get();
+        detail::_new_metatable(state.GetState(), *_metatable);
+        detail::_mark_share<T>(state.GetState());
+        _meta_registry.Insert(typeid(T), *_metatable);
         _register_dtor(state);
         _register_ctor(state);
         _register_members(state, members...);
-        lua_pushvalue(state.GetState(), -1);
-        lua_setfield(state.GetState(), -1, "__index");
+        _register_index(state);
     }
     ~Class() {
-        if (_should_erase) _meta_registry.Erase(typeid(T));
+        if (!_should_erase) return;
+        _meta_registry.Erase(typeid(T));
+        // The metatable stays registered under its name, which a class
+        // registered again under the same name reuses with a new ref
+        lua_State *l = _properties->State().GetState();
+        if (l != nullptr) luaL_unref(l, LUA_REGISTRYINDEX, _metatable->ref);
+    }
+    const detail::BasePool *GetPool() const override {
+        return _pool.get();
     }
     Class(const Class &) = delete;
     Class& operator=(const Class &) = delete;
     Class(Class &&other)
         : _should_erase{true}
         , _name{std::move(other._name)}
-        , _metatable_name{std::move(other._metatable_name)}
+        , _metatable{std::move(other._metatable)}
+        , _properties{std::move(other._properties)}
+        , _upcasts{std::move(other._upcasts)}
+        , _pool{std::move(other._pool)}
         , _ctor{std::move(other._ctor)}
         , _dtor{std::move(other._dtor)}
         , _funs{std::move(other._funs)}
@@ -164,7 +435,10 @@ public:
     Class& operator=(Class &&other) {
         if (&other == this) return *this;
         _name = std::move(other._name);
-        _metatable_name = std::move(other._metatable_name);
+        _metatable = std::move(other._metatable);
+        _properties = std::move(other._properties);
+        _upcasts = std::move(other._upcasts);
+        _pool = std::move(other._pool);
         _ctor = std::move(other._ctor);
         _dtor = std::move(other._dtor);
         _funs = std::move(other._funs);
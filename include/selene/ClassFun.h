@@ -11,11 +11,11 @@ private:
     using _fun_type = std::function<Ret(T*, Args...)>;
     _fun_type _fun;
     std::string _name;
-    std::string _metatable_name;
+    const detail::Metatable &_metatable;
     const detail::StateBlock &_state;
 
     T *_get(const detail::StateBlock &state) {
-        T *ret = (T *)luaL_checkudata(state.GetState(), 1, _metatable_name.c_str());
+        T *ret = (T *)detail::_check_udata(state.GetState(), 1, _metatable);
         lua_remove(state.GetState(), 1);
         return ret;
     }
@@ -23,17 +23,18 @@ private:
 public:
     ClassFun(const detail::StateBlock &l,
              const std::string &name,
-             const std::string &metatable_name,
+             const detail::Metatable &metatable,
+             const std::string &label,
              Ret(*fun)(Args...))
-        : ClassFun(l, name, _fun_type{fun}) {}
+        : ClassFun(l, name, metatable, label, _fun_type{fun}) {}
 
     ClassFun(const detail::StateBlock &l,
              const std::string &name,
-             const std::string &metatable_name,
+             const detail::Metatable &metatable,
+             const std::string &label,
              _fun_type fun)
-        : _fun(fun), _name(name), _metatable_name(metatable_name), _state(l) {
-        lua_pushlightuserdata(l.GetState(), (void *)static_cast<BaseFun *>(this));
-        lua_pushcclosure(l.GetState(), &detail::_lua_dispatcher, 1);
+        : _fun(fun), _name(name), _metatable(metatable), _state(l) {
+        detail::_push_dispatcher(l, this, label);
         lua_setfield(l.GetState(), -2, name.c_str());
     }
 
@@ -42,7 +43,8 @@ public:
         std::tuple<Args...> args = detail::_get_args<Args...>((_state));
         std::tuple<T*, Args...> pack = std::tuple_cat(t, args);
         Ret value = detail::_lift(_fun, pack);
-        detail::_push(_state, std::forward<Ret>(value));
+        detail::_push(_state, detail::_metatables(_state),
+                      std::forward<Ret>(value));
         return N;
     }
 };
@@ -53,11 +55,11 @@ private:
     using _fun_type = std::function<void(T*, Args...)>;
     _fun_type _fun;
     std::string _name;
-    std::string _metatable_name;
+    const detail::Metatable &_metatable;
     const detail::StateBlock &_state;
 
     T *_get(const detail::StateBlock &state) {
-        T *ret = (T *)luaL_checkudata(state.GetState(), 1, _metatable_name.c_str());
+        T *ret = (T *)detail::_check_udata(state.GetState(), 1, _metatable);
         lua_remove(state.GetState(), 1);
         return ret;
     }
@@ -65,17 +67,18 @@ private:
 public:
     ClassFun(const detail::StateBlock &l,
              const std::string &name,
-             const std::string &metatable_name,
+             const detail::Metatable &metatable,
+             const std::string &label,
              void(*fun)(Args...))
-        : ClassFun(l, name, metatable_name, _fun_type{fun}) {}
+        : ClassFun(l, name, metatable, label, _fun_type{fun}) {}
 
     ClassFun(const detail::StateBlock &l,
              const std::string &name,
-             const std::string &metatable_name,
+             const detail::Metatable &metatable,
+             const std::string &label,
              _fun_type fun)
-        : _fun(fun), _name(name), _metatable_name(metatable_name), _state(l) {
-        lua_pushlightuserdata(l.GetState(), (void *)static_cast<BaseFun *>(this));
-        lua_pushcclosure(l.GetState(), &detail::_lua_dispatcher, 1);
+        : _fun(fun), _name(name), _metatable(metatable), _state(l) {
+        detail::_push_dispatcher(l, this, label);
         lua_setfield(l.GetState(), -2, name.c_str());
     }
 
@@ -0,0 +1,340 @@
+#pragma once
+
+#include <cstddef>
+#include "exotics.h"
+#include <type_traits>
+#include <utility>
+
+namespace sel {
+/*
+ * A C++ container indexed by Lua in place:
+ *
+ *     std::vector<double> samples(1 << 20);
+ *     state["samples"] = sel::ContainerRef<std::vector<double>>{samples};
+ *
+ * Lua gets a userdata holding only a pointer. Element reads and writes,
+ * #, pairs and ipairs go straight to the container, so a script that
+ * touches a few elements never copies the rest. Random access sequences
+ * (vector, array, deque) are indexed from 1 and assigning one past the
+ * end appends where the container has push_back. Maps are indexed by
+ * key and assigning nil erases. The container must outlive every Lua
+ * reference to it.
+ */
+template <typename C>
+class ContainerRef {
+private:
+    C *_container;
+
+public:
+    // An empty reference, as read from a value that is not a proxy
+    ContainerRef() : _container(nullptr) {}
+    explicit ContainerRef(C &container) : _container(&container) {}
+
+    explicit operator bool() const {
+        return _container != nullptr;
+    }
+
+    C &Get() const {
+        return *_container;
+    }
+
+    auto begin() const -> decltype(_container->begin()) {
+        return _container->begin();
+    }
+
+    auto end() const -> decltype(_container->end()) {
+        return _container->end();
+    }
+};
+
+namespace detail {
+
+template <typename C, typename = void>
+struct _is_map : std::false_type {};
+
+template <typename C>
+struct _is_map<C, typename std::conditional<
+                      false, typename C::mapped_type, void>::type>
+    : std::true_type {};
+
+template <typename C, typename = void>
+struct _can_append : std::false_type {};
+
+template <typename C>
+struct _can_append<C, typename std::conditional<
+                          false,
+                          decltype(std::declval<C &>().push_back(
+                                       std::declval<typename C::value_type>())),
+                          void>::type>
+    : std::true_type {};
+
+// The metatable of every proxy for C, kept in the registry under Key.
+// Upvalue 1 of each metamethod is the StateBlock and upvalue 2 the
+// metatable, which proxies are checked against.
+template <typename C>
+struct _container_proxy {
+    using Value = typename C::value_type;
+
+    static char *Key() {
+        static char key;
+        return &key;
+    }
+
+    static const StateBlock &State(lua_State *l) {
+        return *static_cast<const StateBlock *>(
+            lua_touserdata(l, lua_upvalueindex(1)));
+    }
+
+    // The container behind the proxy at index, or null if the value
+    // there has another metatable than the one at metatable, which must
+    // not be a relative index
+    static C *To(lua_State *l, int index, int metatable) {
+        if (lua_type(l, index) != LUA_TUSERDATA || !lua_getmetatable(l, index)) {
+            return nullptr;
+        }
+        const bool match = lua_rawequal(l, -1, metatable) != 0;
+        lua_pop(l, 1);
+        return match ? *static_cast<C **>(lua_touserdata(l, index)) : nullptr;
+    }
+
+    static C &Check(lua_State *l, int index, int metatable) {
+        C *c = To(l, index, metatable);
+        if (c == nullptr) {
+            luaL_argerror(l, index, lua_pushfstring(l, "container expected, got %s",
+                                                    luaL_typename(l, index)));
+        }
+        return *c;
+    }
+
+    static C &Self(lua_State *l) {
+        return Check(l, 1, lua_upvalueindex(2));
+    }
+
+    // Converts the key at index 2 to a 0-based position, or returns
+    // false when it is not an integer in [1, limit]
+    static bool Position(lua_State *l, std::size_t limit, std::size_t &i) {
+        if (lua_type(l, 2) != LUA_TNUMBER) return false;
+        const lua_Integer n = lua_tointeger(l, 2);
+        if (static_cast<lua_Number>(n) != lua_tonumber(l, 2)) return false;
+        if (n < 1 || static_cast<std::size_t>(n) > limit) return false;
+        i = static_cast<std::size_t>(n - 1);
+        return true;
+    }
+
+    static void Append(C &c, Value &&value, std::true_type) {
+        c.push_back(std::move(value));
+    }
+
+    static void Append(C &, Value &&, std::false_type) {}
+
+    // Sequences
+
+    static int Index(lua_State *l, std::false_type) {
+        C &c = Self(l);
+        std::size_t i;
+        if (!Position(l, c.size(), i)) {
+            lua_pushnil(l);
+            return 1;
+        }
+        const Value &value = c[i];
+        _push(State(l), value);
+        return 1;
+    }
+
+    static int NewIndex(lua_State *l, std::false_type) {
+        C &c = Self(l);
+        const std::size_t size = c.size();
+        const std::size_t limit = _can_append<C>::value ? size + 1 : size;
+        std::size_t i;
+        if (!Position(l, limit, i)) {
+            return luaL_error(l, "index out of range for a container of size %d",
+                              static_cast<int>(size));
+        }
+        if (i < size) {
+            c[i] = _check_get(_id<Value>{}, State(l), 3);
+        } else {
+            Append(c, _check_get(_id<Value>{}, State(l), 3), _can_append<C>{});
+        }
+        return 0;
+    }
+
+    static int Next(lua_State *l, std::false_type) {
+        C &c = Self(l);
+        const std::size_t i = static_cast<std::size_t>(lua_tointeger(l, 2));
+        if (i >= c.size()) return 0;
+        lua_pushinteger(l, static_cast<lua_Integer>(i + 1));
+        const Value &value = c[i];
+        _push(State(l), value);
+        return 2;
+    }
+
+    static void PushStart(lua_State *l, std::false_type) {
+        lua_pushinteger(l, 0);
+    }
+
+    // Maps
+
+    static int Index(lua_State *l, std::true_type) {
+        C &c = Self(l);
+        auto it = c.find(_check_get(_id<typename C::key_type>{}, State(l), 2));
+        if (it == c.end()) {
+            lua_pushnil(l);
+            return 1;
+        }
+        // Const so strings pick their by-value overload
+        const typename C::mapped_type &value = it->second;
+        _push(State(l), value);
+        return 1;
+    }
+
+    static int NewIndex(lua_State *l, std::true_type) {
+        C &c = Self(l);
+        auto key = _check_get(_id<typename C::key_type>{}, State(l), 2);
+        if (lua_isnil(l, 3)) {
+            c.erase(key);
+            return 0;
+        }
+        auto value = _check_get(_id<typename C::mapped_type>{}, State(l), 3);
+        auto it = c.find(key);
+        if (it == c.end()) {
+            c.emplace(std::move(key), std::move(value));
+        } else {
+            it->second = std::move(value);
+        }
+        return 0;
+    }
+
+    // Continues from the previous key, so erasing the current entry
+    // ends the traversal
+    static int Next(lua_State *l, std::true_type) {
+        C &c = Self(l);
+        auto it = c.begin();
+        if (!lua_isnil(l, 2)) {
+            it = c.find(_check_get(_id<typename C::key_type>{}, State(l), 2));
+            if (it != c.end()) ++it;
+        }
+        if (it == c.end()) return 0;
+        const typename C::value_type &entry = *it;
+        _push(State(l), entry.first);
+        _push(State(l), entry.second);
+        return 2;
+    }
+
+    static void PushStart(lua_State *l, std::true_type) {
+        lua_pushnil(l);
+    }
+
+    static int Index(lua_State *l) {
+        return Index(l, _is_map<C>{});
+    }
+
+    static int NewIndex(lua_State *l) {
+        return NewIndex(l, _is_map<C>{});
+    }
+
+    static int Len(lua_State *l) {
+        lua_pushinteger(l, static_cast<lua_Integer>(Self(l).size()));
+        return 1;
+    }
+
+    static int Next(lua_State *l) {
+        return Next(l, _is_map<C>{});
+    }
+
+    static int Pairs(lua_State *l) {
+        Self(l);
+        lua_pushvalue(l, lua_upvalueindex(3));
+        lua_pushvalue(l, 1);
+        PushStart(l, _is_map<C>{});
+        return 3;
+    }
+
+    // Pushes the upvalues for a metamethod of the metatable on top of
+    // the stack
+    static void PushUpvalues(const StateBlock &state) {
+        lua_State *l = state.GetState();
+        lua_pushlightuserdata(l, const_cast<StateBlock *>(&state));
+        lua_pushvalue(l, -2);
+    }
+
+    static void SetField(const StateBlock &state, const char *name,
+                         lua_CFunction fun) {
+        lua_State *l = state.GetState();
+        PushUpvalues(state);
+        lua_pushcclosure(l, fun, 2);
+        lua_setfield(l, -2, name);
+    }
+
+    // Fills the metatable on top of the stack
+    static void Register(const StateBlock &state) {
+        lua_State *l = state.GetState();
+        SetField(state, "__index", &Index);
+        SetField(state, "__newindex", &NewIndex);
+        SetField(state, "__len", &Len);
+        PushUpvalues(state);
+        lua_pushlightuserdata(l, const_cast<StateBlock *>(&state));
+        lua_pushvalue(l, -4);
+        lua_pushcclosure(l, &Next, 2);
+        lua_pushcclosure(l, &Pairs, 3);
+        if (!_is_map<C>::value) {
+            lua_pushvalue(l, -1);
+            lua_setfield(l, -3, "__ipairs");
+        }
+        lua_setfield(l, -2, "__pairs");
+    }
+
+    // Pushes the metatable, creating it on first use
+    static void PushMetatable(const StateBlock &state) {
+        lua_State *l = state.GetState();
+        lua_pushlightuserdata(l, Key());
+        lua_rawget(l, LUA_REGISTRYINDEX);
+        if (!lua_isnil(l, -1)) return;
+        lua_pop(l, 1);
+        lua_newtable(l);
+        Register(state);
+        lua_pushlightuserdata(l, Key());
+        lua_pushvalue(l, -2);
+        lua_rawset(l, LUA_REGISTRYINDEX);
+    }
+};
+
+template <typename C>
+inline ContainerRef<C> _get(_id<ContainerRef<C>>, const StateBlock &l,
+                            const int index) {
+    lua_State *state = l.GetState();
+    const int proxy = index < 0 && index > LUA_REGISTRYINDEX
+        ? lua_gettop(state) + index + 1 : index;
+    _container_proxy<C>::PushMetatable(l);
+    C *c = _container_proxy<C>::To(state, proxy, lua_gettop(state));
+    lua_pop(state, 1);
+    return c != nullptr ? ContainerRef<C>{*c} : ContainerRef<C>{};
+}
+
+template <typename C>
+inline ContainerRef<C> _check_get(_id<ContainerRef<C>>, const StateBlock &l,
+                                  const int index) {
+    lua_State *state = l.GetState();
+    const int proxy = index < 0 && index > LUA_REGISTRYINDEX
+        ? lua_gettop(state) + index + 1 : index;
+    _container_proxy<C>::PushMetatable(l);
+    C &c = _container_proxy<C>::Check(state, proxy, lua_gettop(state));
+    lua_pop(state, 1);
+    return ContainerRef<C>{c};
+}
+
+template <typename C>
+inline void _push(const StateBlock &l, const ContainerRef<C> &ref) {
+    lua_State *state = l.GetState();
+    C **slot = static_cast<C **>(lua_newuserdata(state, sizeof(C *)));
+    *slot = &ref.Get();
+    _container_proxy<C>::PushMetatable(l);
+    lua_setmetatable(state, -2);
+}
+
+template <typename C>
+inline void _push(const StateBlock &l, MetatableRegistry &,
+                  const ContainerRef<C> &ref) {
+    _push(l, ref);
+}
+}
+}
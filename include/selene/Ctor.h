@@ -1,6 +1,7 @@
 #pragma once
 
 #include "BaseFun.h"
+#include "ObjectPool.h"
 
 namespace sel {
 
@@ -10,19 +11,27 @@ private:
     using _ctor_type = std::function<void(const detail::StateBlock &, Args...)>;
     _ctor_type _ctor;
     const detail::StateBlock &_state;
+    detail::ObjectPool<T> *_pool = nullptr;
 public:
     Ctor(const detail::StateBlock &l,
-         const std::string &metatable_name):_state(l) {
-        _ctor = [metatable_name](const detail::StateBlock &state, Args... args) {
-            void *addr = lua_newuserdata(state.GetState(), sizeof(T));
-            new(addr) T(args...);
-            luaL_setmetatable(state.GetState(), metatable_name.c_str());
+         const detail::Metatable &metatable,
+         const std::string &label):_state(l) {
+        _ctor = [this, &metatable](const detail::StateBlock &state, Args... args) {
+            T *object = _pool != nullptr
+                ? detail::_new_pooled(state.GetState(), *_pool, args...)
+                : detail::_new_object<T>(state.GetState(), args...);
+            detail::_set_metatable(state.GetState(), metatable);
+            detail::_cache_identity(state, object);
         };
-        lua_pushlightuserdata(l.GetState(), (void *)static_cast<BaseFun *>(this));
-        lua_pushcclosure(l.GetState(), &detail::_lua_dispatcher, 1);
+        detail::_push_dispatcher(l, this, label);
         lua_setfield(l.GetState(), -2, "new");
     }
 
+    // Allocates the instances from the pool instead of the Lua heap
+    void UsePool(detail::ObjectPool<T> *pool) {
+        _pool = pool;
+    }
+
     int Apply() override {
         std::tuple<Args...> args = detail::_get_args<Args...>(_state);
         auto pack = std::tuple_cat(std::make_tuple(std::cref(_state)), args);
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+namespace sel {
+
+enum class LogLevel { Debug, Info, Warning, Error };
+
+inline const char *ToString(LogLevel level) {
+    switch (level) {
+    case LogLevel::Debug: return "debug";
+    case LogLevel::Info: return "info";
+    case LogLevel::Warning: return "warning";
+    case LogLevel::Error: return "error";
+    }
+    return "?";
+}
+
+/*
+ * One diagnostic reported by a State. event names what was being done
+ * ("load", "run" or "call"), source is the file involved, if any, and
+ * code is the Lua status code.
+ */
+struct Diagnostic {
+    LogLevel level = LogLevel::Error;
+    const char *event = "";
+    std::string source;
+    std::string message;
+    int code = 0;
+};
+
+/*
+ * Receives the diagnostics of a State. Write may be called from any
+ * thread that uses the State.
+ */
+class DiagnosticsSink {
+public:
+    virtual ~DiagnosticsSink() {}
+    virtual void Write(const Diagnostic &diagnostic) = 0;
+};
+
+/*
+ * Writes one line per diagnostic to a stream, without flushing.
+ */
+class StreamSink : public DiagnosticsSink {
+private:
+    std::ostream &_os;
+    std::mutex _mutex;
+
+public:
+    StreamSink(std::ostream &os) : _os(os) {}
+
+    void Write(const Diagnostic &d) override {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _os << ToString(d.level) << ' ' << d.event;
+        if (!d.source.empty()) _os << ' ' << d.source;
+        _os << ": " << d.message << '\n';
+    }
+};
+
+/*
+ * Hands diagnostics to another sink on a background thread. Producers
+ * claim a slot in a bounded lock-free ring buffer and never block or
+ * take a lock; when the ring is full the diagnostic is dropped and
+ * counted instead. The consumer thread drains the ring into the target
+ * sink, so a slow target only ever stalls that thread.
+ */
+class AsyncSink : public DiagnosticsSink {
+private:
+    // Bounded MPMC queue after D. Vyukov: each slot carries a sequence
+    // number telling producers and the consumer whose turn it is.
+    struct Slot {
+        std::atomic<std::size_t> sequence;
+        Diagnostic diagnostic;
+    };
+
+    std::shared_ptr<DiagnosticsSink> _target;
+    std::unique_ptr<Slot[]> _slots;
+    std::size_t _mask;
+    // Padding keeps the producer and consumer counters on separate
+    // cache lines without needing over-aligned allocation
+    char _pad0[64];
+    std::atomic<std::size_t> _head{0};
+    char _pad1[64];
+    std::atomic<std::size_t> _tail{0};
+    std::atomic<std::size_t> _written{0};
+    char _pad2[64];
+    std::atomic<std::size_t> _dropped{0};
+    std::atomic<bool> _stop{false};
+
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::thread _consumer;
+
+    bool _pop(Diagnostic &out) {
+        std::size_t pos = _tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot &slot = _slots[pos & _mask];
+            std::size_t seq = slot.sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(seq) -
+                static_cast<std::ptrdiff_t>(pos + 1);
+            if (diff == 0) {
+                if (_tail.compare_exchange_weak(pos, pos + 1,
+                                                std::memory_order_relaxed)) {
+                    out = std::move(slot.diagnostic);
+                    slot.sequence.store(pos + _mask + 1,
+                                        std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = _tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void _drain() {
+        Diagnostic d;
+        while (_pop(d)) {
+            _target->Write(d);
+            _written.fetch_add(1, std::memory_order_release);
+        }
+    }
+
+    void _run() {
+        for (;;) {
+            _drain();
+            if (_stop.load(std::memory_order_acquire)) {
+                _drain();
+                return;
+            }
+            // Producers notify without the lock, so a wakeup can be
+            // missed; the timeout bounds the delay when that happens.
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait_for(lock, std::chrono::milliseconds(10));
+        }
+    }
+
+public:
+    // capacity is rounded up to a power of two
+    AsyncSink(std::shared_ptr<DiagnosticsSink> target,
+              std::size_t capacity = 1024)
+        : _target(std::move(target)) {
+        std::size_t size = 2;
+        while (size < capacity) size <<= 1;
+        _slots.reset(new Slot[size]);
+        _mask = size - 1;
+        for (std::size_t i = 0; i < size; ++i) {
+            _slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        _consumer = std::thread(&AsyncSink::_run, this);
+    }
+
+    AsyncSink(const AsyncSink &) = delete;
+    AsyncSink &operator=(const AsyncSink &) = delete;
+
+    // Writes out everything still queued before returning
+    ~AsyncSink() {
+        _stop.store(true, std::memory_order_release);
+        _wake.notify_one();
+        _consumer.join();
+    }
+
+    void Write(const Diagnostic &d) override {
+        std::size_t pos = _head.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot &slot = _slots[pos & _mask];
+            std::size_t seq = slot.sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(seq) -
+                static_cast<std::ptrdiff_t>(pos);
+            if (diff == 0) {
+                if (_head.compare_exchange_weak(pos, pos + 1,
+                                                std::memory_order_relaxed)) {
+                    slot.diagnostic = d;
+                    slot.sequence.store(pos + 1, std::memory_order_release);
+                    _wake.notify_one();
+                    return;
+                }
+            } else if (diff < 0) {
+                _dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            } else {
+                pos = _head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Number of diagnostics dropped because the ring was full
+    std::size_t Dropped() const {
+        return _dropped.load(std::memory_order_relaxed);
+    }
+
+    // Blocks until every diagnostic queued so far has been written
+    void Flush() {
+        std::size_t target = _head.load(std::memory_order_acquire);
+        while (_written.load(std::memory_order_acquire) < target) {
+            _wake.notify_one();
+            std::this_thread::yield();
+        }
+    }
+};
+}
@@ -7,20 +7,24 @@ namespace sel {
 template <typename T>
 class Dtor : public BaseFun {
 private:
-    std::string _metatable_name;
+    const detail::Metatable &_metatable;
     const detail::StateBlock &_state;
 public:
     Dtor(const detail::StateBlock &l,
-         const std::string &metatable_name)
-        : _metatable_name(metatable_name), _state(l) {
-        lua_pushlightuserdata(l.GetState(), (void *)(this));
-        lua_pushcclosure(l.GetState(), &detail::_lua_dispatcher, 1);
+         const detail::Metatable &metatable,
+         const std::string &label)
+        : _metatable(metatable), _state(l) {
+        detail::_push_dispatcher(l, this, label);
         lua_setfield(l.GetState(), -2, "__gc");
     }
 
     int Apply() override {
-        T *t = (T *)luaL_checkudata(_state.GetState(), 1, _metatable_name.c_str());
-        t->~T();
+        lua_State *l = _state.GetState();
+        detail::_check_udata(l, 1, _metatable);
+        // Light userdata own nothing
+        if (lua_type(l, 1) == LUA_TUSERDATA) {
+            detail::_release(static_cast<detail::Userdata *>(lua_touserdata(l, 1)));
+        }
         return 0;
     }
 };
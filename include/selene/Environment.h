@@ -0,0 +1,94 @@
+#pragma once
+
+#include "LuaRef.h"
+#include "Selector.h"
+#include <string>
+#include "util.h"
+
+namespace sel {
+/*
+ * A lightweight sandbox with its own global namespace. Reads of names
+ * the environment does not define fall through to a read-only view of
+ * the global table of the State that created it, while assignments
+ * land in the environment table, leaving the shared globals untouched.
+ * _G names the environment itself. Creating one costs a single table,
+ * so an environment per request is cheap.
+ */
+class Environment {
+private:
+    LuaRef _env;
+
+    static int _read_only(lua_State *l) {
+        return luaL_error(l, "attempt to modify the shared globals");
+    }
+
+    // Pushes an empty table reading from the globals and refusing writes
+    static void _push_globals_view(lua_State *l) {
+        lua_newtable(l);
+        lua_newtable(l);
+#if LUA_VERSION_NUM >= 502
+        lua_pushglobaltable(l);
+#else
+        lua_pushvalue(l, LUA_GLOBALSINDEX);
+#endif
+        lua_setfield(l, -2, "__index");
+        lua_pushcfunction(l, &_read_only);
+        lua_setfield(l, -2, "__newindex");
+        lua_pushboolean(l, 0);
+        lua_setfield(l, -2, "__metatable");
+        lua_setmetatable(l, -2);
+    }
+
+    static int _create(lua_State *l) {
+        lua_newtable(l);
+        // One metatable per state, shared by every environment. It is
+        // hidden from scripts so that they cannot reach the view.
+        if (luaL_newmetatable(l, "sel_environment")) {
+            _push_globals_view(l);
+            lua_setfield(l, -2, "__index");
+            lua_pushboolean(l, 0);
+            lua_setfield(l, -2, "__metatable");
+        }
+        lua_setmetatable(l, -2);
+        lua_pushvalue(l, -1);
+        lua_setfield(l, -2, "_G");
+        return luaL_ref(l, LUA_REGISTRYINDEX);
+    }
+
+    lua_State *_l() const {
+        return _env.GetStateBlock()->GetState();
+    }
+
+public:
+    Environment(const detail::StateBlock &state)
+        : _env(state, _create(state.GetState())) {}
+
+    // Loads and runs a file with this environment as its globals
+    bool Load(const std::string &file) {
+        _env.Push();
+        int env = lua_gettop(_l());
+        bool result = detail::_load(*_env.GetStateBlock(), file, env);
+        lua_settop(_l(), env - 1);
+        return result;
+    }
+
+    bool operator()(const char *code) {
+        _env.Push();
+        int env = lua_gettop(_l());
+        bool result = detail::_dostring(*_env.GetStateBlock(), code, env);
+        lua_settop(_l(), env - 1);
+        return result;
+    }
+    bool operator()(const std::string &code) {
+        return (*this)(code.c_str());
+    }
+
+    Selector operator[](const std::string &name) {
+        return Selector(_env.GetStateBlock(), _env, name);
+    }
+
+    void Push() const {
+        _env.Push();
+    }
+};
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace sel {
+
+/*
+ * The last error raised by Lua code called from C++. The traceback is
+ * only filled in when tracebacks are enabled on the State.
+ */
+struct LuaError {
+    // Status returned by lua_pcall; 0 when there is no error
+    int code = 0;
+    std::string message;
+    std::string traceback;
+
+    explicit operator bool() const {
+        return code != 0;
+    }
+
+    void Clear() {
+        code = 0;
+        message.clear();
+        traceback.clear();
+    }
+};
+
+// An item of a sel::function batch that raised an error
+struct BatchError {
+    std::size_t index;
+    LuaError error;
+};
+}
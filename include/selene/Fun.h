@@ -2,9 +2,13 @@
 
 #include "BaseFun.h"
 #include "MetatableRegistry.h"
-#include <string>
 
 namespace sel {
+/*
+ * A free function or functor called through the dispatcher. Registry
+ * constructs it inside a full userdata held by the Lua closure, so it
+ * lives exactly as long as the closure.
+ */
 template <int N, typename Ret, typename... Args>
 class Fun : public BaseFun {
 private:
@@ -20,10 +24,7 @@ public:
 
     Fun(const detail::StateBlock &l,
         MetatableRegistry &meta_registry,
-        _fun_type fun) : _fun(fun), _meta_registry(meta_registry), _state(l) {
-        lua_pushlightuserdata(l.GetState(), (void *)static_cast<BaseFun *>(this));
-        lua_pushcclosure(l.GetState(), &detail::_lua_dispatcher, 1);
-    }
+        _fun_type fun) : _fun(fun), _meta_registry(meta_registry), _state(l) {}
 
     // Each application of a function receives a new Lua context so
     // this argument is necessary.
@@ -51,10 +52,7 @@ public:
 
     Fun(const detail::StateBlock &l,
         MetatableRegistry &,
-        _fun_type fun) : _fun(fun), _state(l) {
-        lua_pushlightuserdata(l.GetState(), (void *)static_cast<BaseFun *>(this));
-        lua_pushcclosure(l.GetState(), &detail::_lua_dispatcher, 1);
-    }
+        _fun_type fun) : _fun(fun), _state(l) {}
 
     // Each application of a function receives a new Lua context so
     // this argument is necessary.
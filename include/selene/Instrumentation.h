@@ -0,0 +1,127 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+ * Per-binding call statistics. Compile with SELENE_INSTRUMENT defined
+ * to have every call made through detail::_lua_dispatcher counted and
+ * timed. Without it the dispatcher is unchanged and the snapshot is
+ * always empty.
+ */
+
+namespace sel {
+namespace detail {
+
+// Counts and a log-linear latency histogram for one binding. Each
+// power of two of nanoseconds is split into four linear sub-buckets,
+// which bounds the bucket width to 25% of its lower edge.
+class CallStats {
+public:
+    static constexpr int sub_buckets = 4;
+    static constexpr int num_buckets = 64 * sub_buckets;
+
+    std::uint64_t calls = 0;
+    std::uint64_t total_ns = 0;
+    std::uint64_t histogram[num_buckets] = {};
+
+    static int Bucket(std::uint64_t ns) {
+        if (ns < sub_buckets) return static_cast<int>(ns);
+        int msb = 63;
+#if defined(__GNUC__)
+        msb -= __builtin_clzll(ns);
+#else
+        while ((ns >> msb) == 0) --msb;
+#endif
+        int sub = static_cast<int>((ns >> (msb - 2)) & (sub_buckets - 1));
+        return sub_buckets + (msb - 2) * sub_buckets + sub;
+    }
+
+    static std::uint64_t LowerBound(int bucket) {
+        if (bucket < sub_buckets) return bucket;
+        int msb = (bucket - sub_buckets) / sub_buckets + 2;
+        std::uint64_t sub = (bucket - sub_buckets) % sub_buckets;
+        return (sub_buckets + sub) << (msb - 2);
+    }
+
+    void Record(std::uint64_t ns) {
+        ++calls;
+        total_ns += ns;
+        ++histogram[Bucket(ns)];
+    }
+};
+}
+
+struct BindingStats {
+    std::string name;
+    std::uint64_t calls;
+    std::uint64_t total_ns;
+    // (bucket lower bound in ns, count) for every non-empty bucket
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> histogram;
+
+    // Lower bound of the bucket holding the given quantile (0 to 1)
+    std::uint64_t Quantile(double q) const {
+        std::uint64_t rank = static_cast<std::uint64_t>(q * calls);
+        std::uint64_t seen = 0;
+        for (const auto &bucket : histogram) {
+            seen += bucket.second;
+            if (seen > rank) return bucket.first;
+        }
+        return histogram.empty() ? 0 : histogram.back().first;
+    }
+};
+
+class Instrumentation {
+private:
+    // Bindings registered under the same name share their statistics,
+    // so re-registering a function keeps accumulating.
+    std::map<std::string, detail::CallStats> _stats;
+
+public:
+    detail::CallStats *Get(const std::string &name) {
+        return &_stats[name];
+    }
+
+    std::vector<BindingStats> Snapshot() const {
+        std::vector<BindingStats> ret;
+        for (const auto &it : _stats) {
+            const detail::CallStats &stats = it.second;
+            BindingStats snapshot{it.first, stats.calls, stats.total_ns, {}};
+            for (int i = 0; i < detail::CallStats::num_buckets; ++i) {
+                if (stats.histogram[i] != 0) {
+                    snapshot.histogram.emplace_back(
+                        detail::CallStats::LowerBound(i), stats.histogram[i]);
+                }
+            }
+            ret.push_back(std::move(snapshot));
+        }
+        return ret;
+    }
+
+    // Zeroes the entries in place, bound closures pointing to them
+    void Reset() {
+        for (auto &it : _stats) {
+            it.second = detail::CallStats{};
+        }
+    }
+
+    // One line per binding: name, calls, total and mean time and the
+    // p50/p99 bucket bounds, all times in nanoseconds.
+    void WriteText(std::ostream &os) const {
+        for (const auto &stats : Snapshot()) {
+            if (stats.calls == 0) continue;
+            os << stats.name
+               << " calls=" << stats.calls
+               << " total_ns=" << stats.total_ns
+               << " mean_ns=" << stats.total_ns / stats.calls
+               << " p50_ns=" << stats.Quantile(0.5)
+               << " p99_ns=" << stats.Quantile(0.99) << '\n';
+        }
+    }
+};
+}
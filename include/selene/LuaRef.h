@@ -1,5 +1,8 @@
 #pragma once
 
+#include "Diagnostics.h"
+#include "Error.h"
+#include "Instrumentation.h"
 #include <memory>
 
 extern "C" {
@@ -25,11 +28,156 @@ public:
     inline Registry *GetRegistry() const {
         return _registry;
     }
+    inline Instrumentation &GetInstrumentation() const {
+        return _instrumentation;
+    }
+    inline LuaError &GetLastError() const {
+        return _last_error;
+    }
+    inline bool TracebacksEnabled() const {
+        return _tracebacks;
+    }
+    inline void EnableTracebacks(bool enable) const {
+        _tracebacks = enable;
+    }
+    inline void SetDiagnosticsSink(std::shared_ptr<DiagnosticsSink> sink,
+                                   LogLevel level) const {
+        _sink = std::move(sink);
+        _sink_level = level;
+    }
+    inline bool HasDiagnosticsSink() const {
+        return _sink != nullptr;
+    }
+    // Checked before building a Diagnostic so that filtered levels cost
+    // nothing
+    inline bool Reports(LogLevel level) const {
+        return _sink != nullptr && level >= _sink_level;
+    }
+    inline void Report(const Diagnostic &diagnostic) const {
+        _sink->Write(diagnostic);
+    }
+    // Pushes the message handler used by _pcall, creating it on first
+    // use. It is created once per state and kept in the registry.
+    inline void PushErrorHandler() const;
+    // Registry ref of the table mapping object addresses to the
+    // userdata pushed for them, or LUA_NOREF when disabled. Its values
+    // are weak, so it keeps no userdata alive.
+    inline int IdentityCache() const {
+        return _cache_ref;
+    }
+    inline void EnableIdentityCache(bool enable) const;
 private:
     bool _owned;
     lua_State *_state;
     Registry *_registry;
+    mutable Instrumentation _instrumentation;
+    mutable LuaError _last_error;
+    mutable bool _tracebacks = false;
+    mutable int _handler_ref = LUA_NOREF;
+    mutable int _cache_ref = LUA_NOREF;
+    mutable std::shared_ptr<DiagnosticsSink> _sink;
+    mutable LogLevel _sink_level = LogLevel::Warning;
 };
+
+// Message handler for _pcall. Stores a traceback of the failing stack
+// in the StateBlock held as upvalue and passes the error object through.
+inline int _error_handler(lua_State *l) {
+    auto *state = static_cast<const StateBlock *>(
+        lua_touserdata(l, lua_upvalueindex(1)));
+#if LUA_VERSION_NUM >= 502
+    luaL_traceback(l, l, nullptr, 1);
+#else
+    lua_getglobal(l, "debug");
+    if (lua_istable(l, -1)) {
+        lua_getfield(l, -1, "traceback");
+        lua_replace(l, -2);
+        if (lua_isfunction(l, -1)) {
+            lua_pushliteral(l, "");
+            lua_pushinteger(l, 2);
+            lua_call(l, 2, 1);
+        }
+    }
+#endif
+    const char *traceback = lua_tostring(l, -1);
+    if (traceback != nullptr && *traceback == '\n') ++traceback;
+    state->GetLastError().traceback = traceback ? traceback : "";
+    lua_pop(l, 1);
+    return 1;
+}
+
+inline void StateBlock::PushErrorHandler() const {
+    if (_handler_ref == LUA_NOREF) {
+        lua_pushlightuserdata(_state, const_cast<StateBlock *>(this));
+        lua_pushcclosure(_state, &_error_handler, 1);
+        _handler_ref = luaL_ref(_state, LUA_REGISTRYINDEX);
+    }
+    lua_rawgeti(_state, LUA_REGISTRYINDEX, _handler_ref);
+}
+
+inline void StateBlock::EnableIdentityCache(bool enable) const {
+    if (enable && _cache_ref == LUA_NOREF) {
+        lua_newtable(_state);
+        lua_createtable(_state, 0, 1);
+        lua_pushliteral(_state, "v");
+        lua_setfield(_state, -2, "__mode");
+        lua_setmetatable(_state, -2);
+        _cache_ref = luaL_ref(_state, LUA_REGISTRYINDEX);
+    } else if (!enable && _cache_ref != LUA_NOREF) {
+        luaL_unref(_state, LUA_REGISTRYINDEX, _cache_ref);
+        _cache_ref = LUA_NOREF;
+    }
+}
+
+// Records the error object on top of the stack as the last error,
+// reports it to the diagnostics sink and pops it
+inline void _record_error(const StateBlock &state, int status,
+                          const char *event, const std::string &source = "") {
+    lua_State *l = state.GetState();
+    LuaError &error = state.GetLastError();
+    error.code = status;
+    const char *msg = lua_tostring(l, -1);
+    if (msg != nullptr) {
+        error.message = msg;
+    } else {
+        error.message = std::string("(error object is a ") +
+            luaL_typename(l, -1) + " value)";
+    }
+    lua_pop(l, 1);
+    if (state.Reports(LogLevel::Error)) {
+        Diagnostic diagnostic;
+        diagnostic.level = LogLevel::Error;
+        diagnostic.event = event;
+        diagnostic.source = source;
+        diagnostic.message = error.message;
+        diagnostic.code = status;
+        state.Report(diagnostic);
+    }
+}
+
+// Calls the function below the nargs arguments on top of the stack.
+// On failure the error is recorded in the StateBlock and replaced by
+// nresults nils so callers read their results the same way either way.
+inline bool _pcall(const StateBlock &state, int nargs, int nresults,
+                   const char *event = "call") {
+    lua_State *l = state.GetState();
+    int handler = 0;
+    if (state.TracebacksEnabled()) {
+        handler = lua_gettop(l) - nargs;
+        state.PushErrorHandler();
+        lua_insert(l, handler);
+    }
+    int status = lua_pcall(l, nargs, nresults, handler);
+    if (handler != 0) lua_remove(l, handler);
+    if (status == 0) return true;
+
+    // The handler only runs for runtime errors
+    if (handler == 0 || status != LUA_ERRRUN) {
+        state.GetLastError().traceback.clear();
+    }
+    _record_error(state, status, event);
+    for (int i = 0; i < nresults; ++i) lua_pushnil(l);
+    return false;
+}
     
 class LuaRefDeleter {
 private:
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include "LuaRef.h"
+#include <string>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+
+namespace sel {
+/*
+ * A Lua string pinned by a registry reference. The characters are the
+ * ones Lua owns, so taking one as an argument or returning one to Lua
+ * copies nothing, and they stay valid for as long as any copy of the
+ * handle is alive.
+ */
+class LuaString {
+private:
+    LuaRef _ref;
+    const char *_data;
+    std::size_t _size;
+
+    static int _pin(lua_State *l, int index) {
+        lua_pushvalue(l, index);
+        return luaL_ref(l, LUA_REGISTRYINDEX);
+    }
+
+public:
+    // Pins the string at the given stack index
+    LuaString(const detail::StateBlock &state, int index, const char *data,
+              std::size_t size)
+        : _ref(state, _pin(state.GetState(), index)), _data(data), _size(size) {}
+
+    const char *Data() const {
+        return _data;
+    }
+
+    std::size_t Size() const {
+        return _size;
+    }
+
+    std::string ToString() const {
+        return std::string{_data, _size};
+    }
+
+#if __cplusplus >= 201703L
+    std::string_view View() const {
+        return std::string_view{_data, _size};
+    }
+#endif
+
+    void Push() const {
+        _ref.Push();
+    }
+};
+}
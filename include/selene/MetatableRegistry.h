@@ -1,10 +1,104 @@
 #pragma once
 #include <iostream>
 #include <memory>
+#include <string>
 #include <typeinfo>
 #include <unordered_map>
+#include "Userdata.h"
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+}
 
 namespace sel {
+namespace detail {
+
+class PropertyTable;
+
+// A class metatable. Type checks compare metatable pointers and the
+// registry ref pushes it, so neither looks the name up.
+struct Metatable {
+    std::string name;
+    int ref;
+    const void *ptr;
+    const PropertyTable *properties;
+};
+
+// Converts a pointer to an object into a pointer to one of its bases,
+// then follows next through the bases of that base
+struct Upcast {
+    void *(*cast)(void *);
+    const Upcast *next;
+};
+
+template <typename T, typename B>
+void *_upcast_to(void *object) {
+    return static_cast<B *>(static_cast<T *>(object));
+}
+
+inline void *_upcast(const Upcast *upcast, void *object) {
+    for (; upcast != nullptr; upcast = upcast->next) {
+        object = upcast->cast(object);
+    }
+    return object;
+}
+
+// Creates the metatable, leaving it on top of the stack
+inline void _new_metatable(lua_State *l, Metatable &metatable) {
+    luaL_newmetatable(l, metatable.name.c_str());
+    _mark_header(l);
+    metatable.ptr = lua_topointer(l, -1);
+    lua_pushvalue(l, -1);
+    metatable.ref = luaL_ref(l, LUA_REGISTRYINDEX);
+}
+
+inline void _set_metatable(lua_State *l, const Metatable &metatable) {
+    lua_rawgeti(l, LUA_REGISTRYINDEX, metatable.ref);
+    lua_setmetatable(l, -2);
+}
+
+inline bool _has_metatable(lua_State *l, int index, const Metatable &metatable) {
+    if (!lua_getmetatable(l, index)) return false;
+    const bool match = lua_topointer(l, -1) == metatable.ptr;
+    lua_pop(l, 1);
+    return match;
+}
+
+// luaL_testudata without the lookup by name, returning the instance or
+// null. The metatable of a derived class maps each base Metatable to
+// its Upcast, so an instance of a derived class is accepted and
+// adjusted to the base.
+inline void *_test_udata(lua_State *l, int index, const Metatable &metatable) {
+    // Read before the metatable is pushed, for relative indices
+    auto *block = static_cast<Userdata *>(lua_touserdata(l, index));
+    if (lua_type(l, index) != LUA_TUSERDATA || !lua_getmetatable(l, index)) {
+        return nullptr;
+    }
+    if (lua_topointer(l, -1) == metatable.ptr) {
+        lua_pop(l, 1);
+        return block->object;
+    }
+    lua_pushlightuserdata(l, const_cast<Metatable *>(&metatable));
+    lua_rawget(l, -2);
+    const bool derived = lua_islightuserdata(l, -1);
+    auto *upcast = static_cast<const Upcast *>(lua_touserdata(l, -1));
+    lua_pop(l, 2);
+    return derived ? _upcast(upcast, block->object) : nullptr;
+}
+
+// luaL_checkudata without the lookup by name
+inline void *_check_udata(lua_State *l, int index, const Metatable &metatable) {
+    void *udata = _test_udata(l, index, metatable);
+    if (udata == nullptr) {
+        luaL_argerror(l, index, lua_pushfstring(l, "%s expected, got %s",
+                                                metatable.name.c_str(),
+                                                luaL_typename(l, index)));
+    }
+    return udata;
+}
+}
+
 class MetatableRegistry {
 private:
     using TypeID = std::reference_wrapper<const std::type_info>;
@@ -18,20 +112,20 @@ private:
             return lhs.get() == rhs.get();
         }
     };
-    std::unordered_map<TypeID, const std::string*, Hasher, EqualTo> _metatables;
+    std::unordered_map<TypeID, const detail::Metatable*, Hasher, EqualTo> _metatables;
 
 public:
     MetatableRegistry() {}
 
-    inline void Insert(TypeID type, const std::string& name) {
-        _metatables[type] = &name;
+    inline void Insert(TypeID type, const detail::Metatable &metatable) {
+        _metatables[type] = &metatable;
     }
 
     inline void Erase(TypeID type) {
         _metatables.erase(type);
     }
 
-    inline const std::string* Find(TypeID type) {
+    inline const detail::Metatable* Find(TypeID type) {
         auto it = _metatables.find(type);
         if (it == _metatables.end()) return nullptr;
         return it->second;
@@ -0,0 +1,467 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include "LuaRef.h"
+#include <memory>
+#include <new>
+#include "primitives.h"
+#include <type_traits>
+
+namespace sel {
+/*
+ * A contiguous array of float, double, std::int32_t or std::int64_t,
+ * held in 64-byte aligned storage that copies share. Pushed to Lua it
+ * becomes a userdata sharing the same storage, indexed from 1, with #
+ * and these methods running over the whole array in C++:
+ *
+ *     a:sum()  a:min()  a:max()  a:dot(b)
+ *     a:scale(k)  a:add(b or k)  a:axpy(k, b)  a:prefix_sum()
+ *     a:mask(op, v)  a:copy()
+ *
+ * scale, add, axpy and prefix_sum work in place. mask returns a new
+ * array of 1s and 0s comparing each element with v using one of <, <=,
+ * >, >=, == or ~=, so a:mask('>', 0):dot(a) sums the positive elements.
+ * A NumArray taken as an argument or read from a selector is a view of
+ * the Lua array's storage, not a copy.
+ */
+template <typename T>
+class NumArray {
+    static_assert(std::is_same<T, float>::value || std::is_same<T, double>::value ||
+                  std::is_same<T, std::int32_t>::value ||
+                  std::is_same<T, std::int64_t>::value,
+                  "NumArray holds float, double, int32_t or int64_t");
+
+private:
+    std::shared_ptr<T> _data;
+    std::size_t _size;
+
+    static std::shared_ptr<T> _allocate(std::size_t size) {
+        std::size_t bytes = size * sizeof(T) + alignment;
+        unsigned char *raw = new unsigned char[bytes];
+        void *data = raw;
+        std::align(alignment, size * sizeof(T), data, bytes);
+        std::memset(data, 0, size * sizeof(T));
+        return std::shared_ptr<T>(static_cast<T *>(data),
+                                  [raw](T *) { delete[] raw; });
+    }
+
+public:
+    static constexpr std::size_t alignment = 64;
+
+    // Zero filled
+    explicit NumArray(std::size_t size = 0)
+        : _data(_allocate(size)), _size(size) {}
+
+    NumArray(const T *values, std::size_t size) : NumArray(size) {
+        std::copy(values, values + size, _data.get());
+    }
+
+    NumArray(std::initializer_list<T> values)
+        : NumArray(values.begin(), values.size()) {}
+
+    T *Data() const {
+        return _data.get();
+    }
+
+    std::size_t Size() const {
+        return _size;
+    }
+
+    T &operator[](std::size_t i) const {
+        return _data.get()[i];
+    }
+
+    T *begin() const {
+        return _data.get();
+    }
+
+    T *end() const {
+        return _data.get() + _size;
+    }
+
+    // A new array with its own storage
+    NumArray Copy() const {
+        return NumArray(_data.get(), _size);
+    }
+};
+
+template <typename T>
+constexpr std::size_t NumArray<T>::alignment;
+
+namespace detail {
+
+// Kernels. Reductions keep four independent accumulators so the
+// compiler can vectorize them without reassociating floating point
+// additions; the rest are plain loops over the aligned storage.
+
+template <typename T>
+using _num_wide = typename std::conditional<std::is_integral<T>::value,
+                                            std::int64_t, double>::type;
+
+template <typename T>
+inline _num_wide<T> _num_sum(const T *x, std::size_t n) {
+    _num_wide<T> a0 = 0, a1 = 0, a2 = 0, a3 = 0;
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        a0 += x[i];
+        a1 += x[i + 1];
+        a2 += x[i + 2];
+        a3 += x[i + 3];
+    }
+    for (; i < n; ++i) a0 += x[i];
+    return (a0 + a1) + (a2 + a3);
+}
+
+template <typename T>
+inline _num_wide<T> _num_dot(const T *x, const T *y, std::size_t n) {
+    _num_wide<T> a0 = 0, a1 = 0, a2 = 0, a3 = 0;
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        a0 += _num_wide<T>(x[i]) * y[i];
+        a1 += _num_wide<T>(x[i + 1]) * y[i + 1];
+        a2 += _num_wide<T>(x[i + 2]) * y[i + 2];
+        a3 += _num_wide<T>(x[i + 3]) * y[i + 3];
+    }
+    for (; i < n; ++i) a0 += _num_wide<T>(x[i]) * y[i];
+    return (a0 + a1) + (a2 + a3);
+}
+
+// n must be at least 1
+template <typename T>
+inline T _num_min(const T *x, std::size_t n) {
+    T m = x[0];
+    for (std::size_t i = 1; i < n; ++i) m = x[i] < m ? x[i] : m;
+    return m;
+}
+
+template <typename T>
+inline T _num_max(const T *x, std::size_t n) {
+    T m = x[0];
+    for (std::size_t i = 1; i < n; ++i) m = x[i] > m ? x[i] : m;
+    return m;
+}
+
+template <typename T>
+inline void _num_scale(T *x, std::size_t n, T k) {
+    for (std::size_t i = 0; i < n; ++i) x[i] *= k;
+}
+
+template <typename T>
+inline void _num_add(T *x, std::size_t n, T k) {
+    for (std::size_t i = 0; i < n; ++i) x[i] += k;
+}
+
+template <typename T>
+inline void _num_axpy(T *y, const T *x, std::size_t n, T a) {
+    for (std::size_t i = 0; i < n; ++i) y[i] += a * x[i];
+}
+
+template <typename T>
+inline void _num_prefix_sum(T *x, std::size_t n) {
+    for (std::size_t i = 1; i < n; ++i) x[i] += x[i - 1];
+}
+
+template <typename T, typename Compare>
+inline void _num_mask(const T *x, T *out, std::size_t n, T v, Compare compare) {
+    for (std::size_t i = 0; i < n; ++i) out[i] = compare(x[i], v) ? T(1) : T(0);
+}
+
+// The metatable of NumArray<T> userdata, each holding a NumArray<T>,
+// kept in the registry under Key. Upvalue 1 of every method and
+// metamethod is the metatable, which arrays are checked against.
+template <typename T>
+struct _num_array {
+    using Array = NumArray<T>;
+
+    static char *Key() {
+        static char key;
+        return &key;
+    }
+
+    // The array at index, or null if the value there has another
+    // metatable than the one at metatable, which must not be a relative
+    // index
+    static Array *To(lua_State *l, int index, int metatable) {
+        if (lua_type(l, index) != LUA_TUSERDATA || !lua_getmetatable(l, index)) {
+            return nullptr;
+        }
+        const bool match = lua_rawequal(l, -1, metatable) != 0;
+        lua_pop(l, 1);
+        return match ? static_cast<Array *>(lua_touserdata(l, index)) : nullptr;
+    }
+
+    static Array &CheckArray(lua_State *l, int index, int metatable) {
+        Array *a = To(l, index, metatable);
+        if (a == nullptr) {
+            luaL_argerror(l, index, lua_pushfstring(l, "NumArray expected, got %s",
+                                                    luaL_typename(l, index)));
+        }
+        return *a;
+    }
+
+    static Array &Self(lua_State *l, int index = 1) {
+        return CheckArray(l, index, lua_upvalueindex(1));
+    }
+
+    static T Check(lua_State *l, int index, std::true_type) {
+        return static_cast<T>(luaL_checkinteger(l, index));
+    }
+
+    static T Check(lua_State *l, int index, std::false_type) {
+        return static_cast<T>(luaL_checknumber(l, index));
+    }
+
+    static T Check(lua_State *l, int index) {
+        return Check(l, index, std::is_integral<T>{});
+    }
+
+    static void PushNumber(lua_State *l, T value, std::true_type) {
+        lua_pushinteger(l, static_cast<lua_Integer>(value));
+    }
+
+    static void PushNumber(lua_State *l, T value, std::false_type) {
+        lua_pushnumber(l, static_cast<lua_Number>(value));
+    }
+
+    static void PushNumber(lua_State *l, T value) {
+        PushNumber(l, value, std::is_integral<T>{});
+    }
+
+    static void PushWide(lua_State *l, _num_wide<T> value) {
+        if (std::is_integral<T>::value) {
+            lua_pushinteger(l, static_cast<lua_Integer>(value));
+        } else {
+            lua_pushnumber(l, static_cast<lua_Number>(value));
+        }
+    }
+
+    // The second array argument, which must have the length of the first
+    static Array &Other(lua_State *l, int index) {
+        Array &other = Self(l, index);
+        if (other.Size() != Self(l).Size()) {
+            luaL_error(l, "arrays of different lengths (%d and %d)",
+                       static_cast<int>(Self(l).Size()),
+                       static_cast<int>(other.Size()));
+        }
+        return other;
+    }
+
+    static bool Position(lua_State *l, const Array &a, std::size_t &i) {
+        if (lua_type(l, 2) != LUA_TNUMBER) return false;
+        const lua_Integer n = lua_tointeger(l, 2);
+        if (static_cast<lua_Number>(n) != lua_tonumber(l, 2)) return false;
+        if (n < 1 || static_cast<std::size_t>(n) > a.Size()) return false;
+        i = static_cast<std::size_t>(n - 1);
+        return true;
+    }
+
+    static int Index(lua_State *l) {
+        Array &a = Self(l);
+        std::size_t i;
+        if (Position(l, a, i)) {
+            PushNumber(l, a[i]);
+        } else if (lua_type(l, 2) == LUA_TSTRING) {
+            lua_pushvalue(l, 2);
+            lua_rawget(l, lua_upvalueindex(2));
+        } else {
+            lua_pushnil(l);
+        }
+        return 1;
+    }
+
+    static int NewIndex(lua_State *l) {
+        Array &a = Self(l);
+        std::size_t i;
+        if (!Position(l, a, i)) {
+            return luaL_error(l, "index out of range for an array of size %d",
+                              static_cast<int>(a.Size()));
+        }
+        a[i] = Check(l, 3);
+        return 0;
+    }
+
+    static int Len(lua_State *l) {
+        lua_pushinteger(l, static_cast<lua_Integer>(Self(l).Size()));
+        return 1;
+    }
+
+    static int Gc(lua_State *l) {
+        Self(l).~Array();
+        return 0;
+    }
+
+    static int Sum(lua_State *l) {
+        Array &a = Self(l);
+        PushWide(l, _num_sum(a.Data(), a.Size()));
+        return 1;
+    }
+
+    static int Min(lua_State *l) {
+        Array &a = Self(l);
+        if (a.Size() == 0) return 0;
+        PushNumber(l, _num_min(a.Data(), a.Size()));
+        return 1;
+    }
+
+    static int Max(lua_State *l) {
+        Array &a = Self(l);
+        if (a.Size() == 0) return 0;
+        PushNumber(l, _num_max(a.Data(), a.Size()));
+        return 1;
+    }
+
+    static int Dot(lua_State *l) {
+        Array &a = Self(l);
+        PushWide(l, _num_dot(a.Data(), Other(l, 2).Data(), a.Size()));
+        return 1;
+    }
+
+    static int Scale(lua_State *l) {
+        Array &a = Self(l);
+        _num_scale(a.Data(), a.Size(), Check(l, 2));
+        return 0;
+    }
+
+    static int Add(lua_State *l) {
+        Array &a = Self(l);
+        if (lua_type(l, 2) == LUA_TNUMBER) {
+            _num_add(a.Data(), a.Size(), Check(l, 2));
+        } else {
+            _num_axpy(a.Data(), Other(l, 2).Data(), a.Size(), T(1));
+        }
+        return 0;
+    }
+
+    static int Axpy(lua_State *l) {
+        Array &a = Self(l);
+        _num_axpy(a.Data(), Other(l, 3).Data(), a.Size(), Check(l, 2));
+        return 0;
+    }
+
+    static int PrefixSum(lua_State *l) {
+        Array &a = Self(l);
+        _num_prefix_sum(a.Data(), a.Size());
+        return 0;
+    }
+
+    static int Mask(lua_State *l) {
+        static const char *const ops[] = {"<", "<=", ">", ">=", "==", "~=", nullptr};
+        Array &a = Self(l);
+        const int op = luaL_checkoption(l, 2, nullptr, ops);
+        const T v = Check(l, 3);
+        Array &out = Push(l, Array(a.Size()), lua_upvalueindex(1));
+        const T *x = a.Data();
+        T *y = out.Data();
+        const std::size_t n = a.Size();
+        switch (op) {
+        case 0: _num_mask(x, y, n, v, [](T e, T w) { return e < w; }); break;
+        case 1: _num_mask(x, y, n, v, [](T e, T w) { return e <= w; }); break;
+        case 2: _num_mask(x, y, n, v, [](T e, T w) { return e > w; }); break;
+        case 3: _num_mask(x, y, n, v, [](T e, T w) { return e >= w; }); break;
+        case 4: _num_mask(x, y, n, v, [](T e, T w) { return e == w; }); break;
+        default: _num_mask(x, y, n, v, [](T e, T w) { return e != w; }); break;
+        }
+        return 1;
+    }
+
+    static int Copy(lua_State *l) {
+        Push(l, Self(l).Copy(), lua_upvalueindex(1));
+        return 1;
+    }
+
+    static void SetField(lua_State *l, const char *name, lua_CFunction fun) {
+        lua_pushvalue(l, -1);
+        lua_pushcclosure(l, fun, 1);
+        lua_setfield(l, -2, name);
+    }
+
+    // Fills the metatable on top of the stack
+    static void Register(lua_State *l) {
+        static const luaL_Reg methods[] = {
+            {"sum", &Sum}, {"min", &Min}, {"max", &Max}, {"dot", &Dot},
+            {"scale", &Scale}, {"add", &Add}, {"axpy", &Axpy},
+            {"prefix_sum", &PrefixSum}, {"mask", &Mask}, {"copy", &Copy},
+        };
+        lua_pushvalue(l, -1);
+        lua_createtable(l, 0, sizeof(methods) / sizeof(methods[0]));
+        for (const luaL_Reg &method : methods) {
+            lua_pushvalue(l, -3);
+            lua_pushcclosure(l, method.func, 1);
+            lua_setfield(l, -2, method.name);
+        }
+        lua_pushcclosure(l, &Index, 2);
+        lua_setfield(l, -2, "__index");
+        SetField(l, "__newindex", &NewIndex);
+        SetField(l, "__len", &Len);
+        SetField(l, "__gc", &Gc);
+    }
+
+    // Pushes the metatable, creating it on first use
+    static void PushMetatable(lua_State *l) {
+        lua_pushlightuserdata(l, Key());
+        lua_rawget(l, LUA_REGISTRYINDEX);
+        if (!lua_isnil(l, -1)) return;
+        lua_pop(l, 1);
+        lua_newtable(l);
+        Register(l);
+        lua_pushlightuserdata(l, Key());
+        lua_pushvalue(l, -2);
+        lua_rawset(l, LUA_REGISTRYINDEX);
+    }
+
+    // Pushes a userdata sharing the storage of array, with the metatable
+    // at metatable, which must not be a relative index
+    static Array &Push(lua_State *l, const Array &array, int metatable) {
+        void *addr = lua_newuserdata(l, sizeof(Array));
+        Array *a = new(addr) Array(array);
+        lua_pushvalue(l, metatable);
+        lua_setmetatable(l, -2);
+        return *a;
+    }
+
+    static void Push(lua_State *l, const Array &array) {
+        PushMetatable(l);
+        Push(l, array, lua_gettop(l));
+        lua_remove(l, -2);
+    }
+};
+
+template <typename T>
+inline NumArray<T> _get(_id<NumArray<T>>, const StateBlock &l, const int index) {
+    lua_State *state = l.GetState();
+    const int array = index < 0 && index > LUA_REGISTRYINDEX
+        ? lua_gettop(state) + index + 1 : index;
+    _num_array<T>::PushMetatable(state);
+    NumArray<T> *a = _num_array<T>::To(state, array, lua_gettop(state));
+    lua_pop(state, 1);
+    return a != nullptr ? *a : NumArray<T>{};
+}
+
+template <typename T>
+inline NumArray<T> _check_get(_id<NumArray<T>>, const StateBlock &l,
+                              const int index) {
+    lua_State *state = l.GetState();
+    const int array = index < 0 && index > LUA_REGISTRYINDEX
+        ? lua_gettop(state) + index + 1 : index;
+    _num_array<T>::PushMetatable(state);
+    NumArray<T> ret = _num_array<T>::CheckArray(state, array, lua_gettop(state));
+    lua_pop(state, 1);
+    return ret;
+}
+
+template <typename T>
+inline void _push(const StateBlock &l, const NumArray<T> &array) {
+    _num_array<T>::Push(l.GetState(), array);
+}
+
+template <typename T>
+inline void _push(const StateBlock &l, MetatableRegistry &,
+                  const NumArray<T> &array) {
+    _num_array<T>::Push(l.GetState(), array);
+}
+}
+}
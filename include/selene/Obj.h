@@ -4,6 +4,7 @@
 #include <functional>
 #include <memory>
 #include "State.h"
+#include "StaticMember.h"
 #include <string>
 #include <utility>
 #include <vector>
@@ -16,6 +17,12 @@ template <typename T, typename... Members>
 class Obj : public BaseObj {
 private:
     std::vector<std::unique_ptr<BaseFun>> _funs;
+    std::string _name;
+
+    // Names a method in instrumentation snapshots
+    std::string _label(const std::string &member_name) const {
+        return _name + "." + member_name;
+    }
 
     template <typename M>
     void _register_member(const detail::StateBlock &state,
@@ -36,14 +43,16 @@ private:
             return t->*member;
         };
         _funs.emplace_back(
-            new ObjFun<1, M>{state, std::string{member_name}, lambda_get});
+            new ObjFun<1, M>{state, std::string{member_name},
+                    _label(member_name), lambda_get});
 
         std::function<void(M)> lambda_set = [t, member](M value) {
             t->*member = value;
         };
         _funs.emplace_back(
             new ObjFun<0, void, M>
-            {state, std::string{"set_"} + member_name, lambda_set});
+            {state, std::string{"set_"} + member_name,
+                    _label(std::string{"set_"} + member_name), lambda_set});
     }
 
     template <typename M>
@@ -56,7 +65,8 @@ private:
             return t->*member;
         };
         _funs.emplace_back(
-            new ObjFun<1, M>{state, std::string{member_name}, lambda_get});
+            new ObjFun<1, M>{state, std::string{member_name},
+                    _label(member_name), lambda_get});
     }
 
     template <typename Ret, typename... Args>
@@ -70,7 +80,7 @@ private:
         constexpr int arity = detail::_arity<Ret>::value;
         _funs.emplace_back(
             new ObjFun<arity, Ret, Args...>
-            {state, std::string(fun_name), lambda});
+            {state, std::string(fun_name), _label(fun_name), lambda});
     }
 
     template <typename Ret, typename... Args>
@@ -84,9 +94,54 @@ private:
         constexpr int arity = detail::_arity<Ret>::value;
         _funs.emplace_back(
             new ObjFun<arity, Ret, Args...>
-            {state, std::string(fun_name), lambda});
+            {state, std::string(fun_name), _label(fun_name), lambda});
+    }
+
+    // Sets a statically bound member in the object table. Its upvalues
+    // are the StateBlock and the object.
+    template <lua_CFunction fun>
+    void _register_static(const detail::StateBlock &state, T *t,
+                          const std::string &name) {
+        lua_State *l = state.GetState();
+        lua_pushlightuserdata(l, const_cast<detail::StateBlock *>(&state));
+        lua_pushlightuserdata(l, (void *)t);
+        detail::_push_static<fun, 2>(state, _label(name));
+        lua_setfield(l, -2, name.c_str());
+    }
+
+    template <typename F, F f>
+    void _register_member(const detail::StateBlock &state,
+                          T *t,
+                          const char *fun_name,
+                          Method<F, f>) {
+        _register_static<&detail::_method<detail::_obj_self, F, f>::Call>(
+            state, t, fun_name);
+    }
+
+    template <typename F, F f>
+    void _register_member(const detail::StateBlock &state,
+                          T *t,
+                          const char *member_name,
+                          Field<F, f>) {
+        using field = detail::_field<detail::_obj_self, F, f>;
+        _register_static<&field::Get>(state, t, member_name);
+        _register_setter<field>(state, t, member_name,
+                                typename field::Settable{});
+    }
+
+    template <typename field>
+    void _register_setter(const detail::StateBlock &state,
+                          T *t,
+                          const char *member_name,
+                          std::true_type) {
+        _register_static<&field::Set>(state, t,
+                                      std::string("set_") + member_name);
     }
 
+    template <typename field>
+    void _register_setter(const detail::StateBlock &, T *, const char *,
+                          std::false_type) {}
+
     void _register_members(const detail::StateBlock &state, T *t) {}
 
     template <typename M, typename... Ms>
@@ -98,7 +153,8 @@ private:
         _register_members(state, t, members...);
     }
 public:
-    Obj(const detail::StateBlock &state, T *t, Members... members) {
+    Obj(const detail::StateBlock &state, const std::string &name, T *t,
+        Members... members) : _name(name) {
         lua_createtable(state.GetState(), 0, sizeof...(Members));
         _register_members(state, t, members...);
     }
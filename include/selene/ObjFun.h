@@ -15,14 +15,15 @@ private:
 public:
     ObjFun(const detail::StateBlock &l,
            const std::string &name,
+           const std::string &label,
            Ret(*fun)(Args...))
-        : ObjFun(l, name, _fun_type{fun}) {}
+        : ObjFun(l, name, label, _fun_type{fun}) {}
 
     ObjFun(const detail::StateBlock &l,
            const std::string &name,
+           const std::string &label,
            _fun_type fun) : _fun(fun), _state(l) {
-        lua_pushlightuserdata(l.GetState(), (void *)static_cast<BaseFun *>(this));
-        lua_pushcclosure(l.GetState(), &detail::_lua_dispatcher, 1);
+        detail::_push_dispatcher(l, this, label);
         lua_setfield(l.GetState(), -2, name.c_str());
     }
 
@@ -31,7 +32,8 @@ public:
     int Apply() override {
         std::tuple<Args...> args = detail::_get_args<Args...>(_state);
         Ret value = detail::_lift(_fun, args);
-        detail::_push(_state, std::forward<Ret>(value));
+        detail::_push(_state, detail::_metatables(_state),
+                      std::forward<Ret>(value));
         return N;
     }
 };
@@ -46,14 +48,15 @@ private:
 public:
     ObjFun(const detail::StateBlock &l,
            const std::string &name,
+           const std::string &label,
            void(*fun)(Args...))
-        : ObjFun(l, name, _fun_type{fun}) {}
+        : ObjFun(l, name, label, _fun_type{fun}) {}
 
     ObjFun(const detail::StateBlock &l,
            const std::string &name,
+           const std::string &label,
            _fun_type fun) : _fun(fun), _state(l) {
-        lua_pushlightuserdata(l.GetState(), (void *)static_cast<BaseFun *>(this));
-        lua_pushcclosure(l.GetState(), &detail::_lua_dispatcher, 1);
+        detail::_push_dispatcher(l, this, label);
         lua_setfield(l.GetState(), -2, name.c_str());
     }
 
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include "Userdata.h"
+#include <vector>
+
+namespace sel {
+
+// Occupancy of the object pool of a class
+struct PoolStats {
+    std::string name;
+    std::size_t object_size;
+    // Objects alive, and slots allocated whether in use or free
+    std::size_t live;
+    std::size_t capacity;
+    std::size_t slabs;
+    std::uint64_t allocations;
+    std::uint64_t releases;
+};
+
+namespace detail {
+
+class BasePool {
+public:
+    virtual ~BasePool() {}
+    virtual PoolStats Stats() const = 0;
+};
+
+/*
+ * Storage for the instances of one class, allocated a slab of slots at
+ * a time outside the Lua heap. Released slots go on a free list and are
+ * reused before a new slab is allocated; slabs are only freed with the
+ * pool.
+ */
+template <typename T>
+class ObjectPool : public BasePool {
+private:
+    union Slot {
+        Slot *next;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    };
+
+    std::string _name;
+    std::size_t _slab_size;
+    // Raw memory, over-allocated so that the slots can be aligned for
+    // types aligned beyond what operator new guarantees
+    std::vector<std::unique_ptr<char[]>> _slabs;
+    Slot *_free = nullptr;
+    std::size_t _live = 0;
+    std::uint64_t _allocations = 0;
+    std::uint64_t _releases = 0;
+
+    void _grow() {
+        std::size_t space = _slab_size * sizeof(Slot) + alignof(Slot) - 1;
+        _slabs.emplace_back(new char[space]);
+        void *memory = _slabs.back().get();
+        Slot *slab = static_cast<Slot *>(
+            std::align(alignof(Slot), _slab_size * sizeof(Slot), memory, space));
+        for (std::size_t i = _slab_size; i-- > 0;) {
+            slab[i].next = _free;
+            _free = &slab[i];
+        }
+    }
+
+public:
+    ObjectPool(const std::string &name, std::size_t slab_size)
+        : _name(name), _slab_size(slab_size > 0 ? slab_size : 1) {}
+
+    ObjectPool(const ObjectPool &) = delete;
+    ObjectPool &operator=(const ObjectPool &) = delete;
+
+    // A constructor that throws gives the slot back
+    template <typename... Args>
+    T *New(Args&&... args) {
+        if (_free == nullptr) _grow();
+        Slot *slot = _free;
+        _free = slot->next;
+        T *object;
+        try {
+            object = new(&slot->storage) T(std::forward<Args>(args)...);
+        } catch (...) {
+            slot->next = _free;
+            _free = slot;
+            throw;
+        }
+        ++_live;
+        ++_allocations;
+        return object;
+    }
+
+    void Delete(T *object) {
+        object->~T();
+        Slot *slot = reinterpret_cast<Slot *>(object);
+        slot->next = _free;
+        _free = slot;
+        --_live;
+        ++_releases;
+    }
+
+    PoolStats Stats() const override {
+        return PoolStats{_name, sizeof(T), _live, _slabs.size() * _slab_size,
+                         _slabs.size(), _allocations, _releases};
+    }
+};
+
+template <typename T>
+inline void _release_pooled(Userdata *udata) {
+    (*_holder<ObjectPool<T> *>(udata))->Delete(static_cast<T *>(udata->object));
+}
+
+// A block holding the pool after the header, the instance being in the
+// pool
+template <typename T, typename... Args>
+inline T *_new_pooled(lua_State *l, ObjectPool<T> &pool, Args&&... args) {
+    auto *udata = static_cast<Userdata *>(
+        lua_newuserdata(l, _block_size<ObjectPool<T> *>()));
+    udata->object = nullptr;
+    udata->release = nullptr;
+    T *object = pool.New(std::forward<Args>(args)...);
+    *_holder<ObjectPool<T> *>(udata) = &pool;
+    udata->object = object;
+    udata->release = &_release_pooled<T>;
+    return object;
+}
+}
+}
@@ -0,0 +1,279 @@
+#pragma once
+
+#include "BaseFun.h"
+#include "primitives.h"
+#include <sstream>
+#include "StaticMember.h"
+#include <string>
+#include <type_traits>
+#include <utility>
+
+namespace sel {
+namespace detail {
+
+// The C++ operators bound as metamethods, each applied to const operands
+
+struct _op_add {
+    static const char *Name() { return "__add"; }
+    template <typename A, typename B>
+    static auto Apply(const A &a, const B &b) -> decltype(a + b) { return a + b; }
+};
+
+struct _op_sub {
+    static const char *Name() { return "__sub"; }
+    template <typename A, typename B>
+    static auto Apply(const A &a, const B &b) -> decltype(a - b) { return a - b; }
+};
+
+struct _op_mul {
+    static const char *Name() { return "__mul"; }
+    template <typename A, typename B>
+    static auto Apply(const A &a, const B &b) -> decltype(a * b) { return a * b; }
+};
+
+struct _op_div {
+    static const char *Name() { return "__div"; }
+    template <typename A, typename B>
+    static auto Apply(const A &a, const B &b) -> decltype(a / b) { return a / b; }
+};
+
+struct _op_mod {
+    static const char *Name() { return "__mod"; }
+    template <typename A, typename B>
+    static auto Apply(const A &a, const B &b) -> decltype(a % b) { return a % b; }
+};
+
+struct _op_eq {
+    static const char *Name() { return "__eq"; }
+    template <typename A, typename B>
+    static auto Apply(const A &a, const B &b) -> decltype(a == b) { return a == b; }
+};
+
+struct _op_lt {
+    static const char *Name() { return "__lt"; }
+    template <typename A, typename B>
+    static auto Apply(const A &a, const B &b) -> decltype(a < b) { return a < b; }
+};
+
+struct _op_le {
+    static const char *Name() { return "__le"; }
+    template <typename A, typename B>
+    static auto Apply(const A &a, const B &b) -> decltype(a <= b) { return a <= b; }
+};
+
+template <typename Op, typename A, typename B, typename = void>
+struct _can_apply : std::false_type {};
+
+template <typename Op, typename A, typename B>
+struct _can_apply<Op, A, B, typename std::conditional<
+                                false,
+                                decltype(Op::Apply(std::declval<const A &>(),
+                                                   std::declval<const B &>())),
+                                void>::type>
+    : std::true_type {};
+
+inline const Metatable &_upvalue_metatable(lua_State *l) {
+    return *static_cast<const Metatable *>(lua_touserdata(l, lua_upvalueindex(2)));
+}
+
+// Results of the class type become new instances owned by Lua; the
+// others are pushed like the results of methods
+template <typename T>
+inline void _push_result(const StateBlock &state, const Metatable &metatable,
+                         T &&value, std::true_type) {
+    lua_State *l = state.GetState();
+    using U = typename std::decay<T>::type;
+    U *object = _new_object<U>(l, std::forward<T>(value));
+    _set_metatable(l, metatable);
+    _cache_identity(state, object);
+}
+
+template <typename R>
+inline void _push_result(const StateBlock &state, const Metatable &,
+                         R &&value, std::false_type) {
+    const typename std::decay<R>::type &result = value;
+    _push(state, _metatables(state), result);
+}
+
+// A binary metamethod. Either operand may be a number when the
+// operator accepts one, as in v * 2 and 2 * v.
+template <typename T, typename Op>
+struct _binary_op {
+    using Defined = std::integral_constant<
+        bool, _can_apply<Op, T, T>::value ||
+              _can_apply<Op, T, lua_Number>::value ||
+              _can_apply<Op, lua_Number, T>::value>;
+
+    static const char *Name() {
+        return Op::Name();
+    }
+
+    template <typename A, typename B>
+    static bool Apply(const StateBlock &state, const A &a, const B &b,
+                      std::true_type) {
+        using R = decltype(Op::Apply(a, b));
+        _push_result(state, _upvalue_metatable(state.GetState()),
+                     Op::Apply(a, b),
+                     std::is_same<typename std::decay<R>::type, T>{});
+        return true;
+    }
+
+    template <typename A, typename B>
+    static bool Apply(const StateBlock &, const A &, const B &,
+                      std::false_type) {
+        return false;
+    }
+
+    template <typename A, typename B>
+    static bool Apply(const StateBlock &state, const A &a, const B &b) {
+        return Apply(state, a, b, _can_apply<Op, A, B>{});
+    }
+
+    static int Call(lua_State *l) {
+        const StateBlock &state = _static_state(l);
+        const Metatable &metatable = _upvalue_metatable(l);
+        const T *a = static_cast<const T *>(_test_udata(l, 1, metatable));
+        const T *b = static_cast<const T *>(_test_udata(l, 2, metatable));
+        bool applied = false;
+        if (a != nullptr && b != nullptr) {
+            applied = Apply(state, *a, *b);
+        } else if (a != nullptr && lua_type(l, 2) == LUA_TNUMBER) {
+            applied = Apply(state, *a, lua_tonumber(l, 2));
+        } else if (b != nullptr && lua_type(l, 1) == LUA_TNUMBER) {
+            applied = Apply(state, lua_tonumber(l, 1), *b);
+        }
+        if (!applied) {
+            return luaL_error(l, "%s is not defined for %s and %s", Op::Name(),
+                              luaL_typename(l, 1), luaL_typename(l, 2));
+        }
+        return 1;
+    }
+};
+
+template <typename T, typename = void>
+struct _can_negate : std::false_type {};
+
+template <typename T>
+struct _can_negate<T, typename std::conditional<
+                          false, decltype(-std::declval<const T &>()), void>::type>
+    : std::true_type {};
+
+template <typename T>
+struct _unm_op {
+    using Defined = _can_negate<T>;
+
+    static const char *Name() {
+        return "__unm";
+    }
+
+    static int Call(lua_State *l) {
+        const T &a = *static_cast<const T *>(
+            _check_udata(l, 1, _upvalue_metatable(l)));
+        using R = decltype(-a);
+        _push_result(_static_state(l), _upvalue_metatable(l), -a,
+                     std::is_same<typename std::decay<R>::type, T>{});
+        return 1;
+    }
+};
+
+template <typename T, typename = void>
+struct _has_size : std::false_type {};
+
+template <typename T>
+struct _has_size<T, typename std::conditional<
+                        false, decltype(std::declval<const T &>().size()),
+                        void>::type>
+    : std::true_type {};
+
+// # calls size()
+template <typename T>
+struct _len_op {
+    using Defined = _has_size<T>;
+
+    static const char *Name() {
+        return "__len";
+    }
+
+    static int Call(lua_State *l) {
+        const T &a = *static_cast<const T *>(
+            _check_udata(l, 1, _upvalue_metatable(l)));
+        lua_pushinteger(l, static_cast<lua_Integer>(a.size()));
+        return 1;
+    }
+};
+
+template <typename T, typename = void>
+struct _can_print : std::false_type {};
+
+template <typename T>
+struct _can_print<T, typename std::conditional<
+                         false,
+                         decltype(std::declval<std::ostream &>()
+                                  << std::declval<const T &>()),
+                         void>::type>
+    : std::true_type {};
+
+// tostring writes the object to a std::ostream
+template <typename T>
+struct _tostring_op {
+    using Defined = _can_print<T>;
+
+    static const char *Name() {
+        return "__tostring";
+    }
+
+    static int Call(lua_State *l) {
+        const T &a = *static_cast<const T *>(
+            _check_udata(l, 1, _upvalue_metatable(l)));
+        std::ostringstream os;
+        os << a;
+        const std::string str = os.str();
+        lua_pushlstring(l, str.data(), str.size());
+        return 1;
+    }
+};
+
+template <typename T, typename = void>
+struct _has_call : std::false_type {};
+
+template <typename T>
+struct _has_call<T, typename std::conditional<
+                        false, decltype(&T::operator()), void>::type>
+    : std::true_type {};
+
+// Calling the object calls operator(), when it is not overloaded
+template <typename T, bool = _has_call<T>::value>
+struct _call_op {
+    using Defined = std::false_type;
+    static const char *Name() {
+        return "__call";
+    }
+    static int Call(lua_State *) {
+        return 0;
+    }
+};
+
+template <typename T>
+struct _call_op<T, true>
+    : _method<_class_self, decltype(&T::operator()), &T::operator()> {
+    using Defined = std::true_type;
+    static const char *Name() {
+        return "__call";
+    }
+};
+}
+
+/*
+ * Binds the operators of a class as metamethods:
+ *
+ *     state["Vec"].SetClass<Vec, double, double>(sel::Operators{},
+ *                                                "x", &Vec::x);
+ *
+ * Every operator the class defines among +, -, *, /, %, unary -, ==,
+ * < and <= is bound as the matching metamethod, along with size() as
+ * __len, operator<< on a std::ostream as __tostring and a single
+ * operator() as __call. Arithmetic operators may also take a number on
+ * either side. Results of the class type are new instances.
+ */
+struct Operators {};
+}
@@ -0,0 +1,267 @@
+#pragma once
+
+#include <array>
+#include "BaseFun.h"
+#include <cstdint>
+#include "Fun.h"
+#include "MetatableRegistry.h"
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace sel {
+class Value;
+
+/*
+ * Several callables bound under one Lua name:
+ *
+ *     state["area"] = sel::overload(&square_area, &rect_area,
+ *                                   [](Shape &s) { return s.Area(); });
+ *
+ * At registration the candidates are grouped by arity and each gets a
+ * type signature: one 4-bit code per argument for the Lua type it
+ * accepts, plus a mask leaving out arguments that accept anything
+ * (sel::Value). A call packs the codes of the lua_type of its first
+ * sixteen arguments the same way and takes the first candidate of its
+ * arity whose signature matches, so resolution costs a few integer
+ * comparisons and never attempts a conversion. Numbers only match
+ * arithmetic parameters and strings only match string parameters.
+ * Candidates ending in sel::Varargs take any number of arguments from
+ * their fixed ones up, and are tried after those of the exact arity.
+ */
+template <typename... Fs>
+struct Overloads {
+    std::tuple<Fs...> funs;
+};
+
+template <typename... Fs>
+Overloads<Fs...> overload(Fs... funs) {
+    return Overloads<Fs...>{std::make_tuple(funs...)};
+}
+
+namespace detail {
+
+constexpr int _signature_args = 16;
+
+// Lua type to signature code. Light and full userdata share a code
+// since object parameters accept both.
+inline std::uint64_t _type_code(int lua_type) {
+    static const std::uint8_t codes[] = {
+        0, // LUA_TNONE
+        1, // LUA_TNIL
+        2, // LUA_TBOOLEAN
+        3, // LUA_TLIGHTUSERDATA
+        4, // LUA_TNUMBER
+        5, // LUA_TSTRING
+        6, // LUA_TTABLE
+        7, // LUA_TFUNCTION
+        3, // LUA_TUSERDATA
+        8, // LUA_TTHREAD
+    };
+    return codes[lua_type + 1];
+}
+
+// The Lua type a parameter of type T accepts, or LUA_TNONE for any
+template <typename T, typename = void>
+struct _param_type {
+    // Objects, by pointer or reference
+    static constexpr int value = LUA_TUSERDATA;
+};
+
+template <typename T>
+struct _param_type<T, typename std::enable_if<
+                          std::is_arithmetic<T>::value &&
+                          !std::is_same<T, bool>::value>::type> {
+    static constexpr int value = LUA_TNUMBER;
+};
+
+template <>
+struct _param_type<bool> {
+    static constexpr int value = LUA_TBOOLEAN;
+};
+
+template <>
+struct _param_type<std::string> {
+    static constexpr int value = LUA_TSTRING;
+};
+
+template <>
+struct _param_type<const char *> {
+    static constexpr int value = LUA_TSTRING;
+};
+
+template <>
+struct _param_type<LuaString> {
+    static constexpr int value = LUA_TSTRING;
+};
+
+#if __cplusplus >= 201703L
+template <>
+struct _param_type<std::string_view> {
+    static constexpr int value = LUA_TSTRING;
+};
+#endif
+
+template <typename S>
+struct _param_type<function<S>> {
+    static constexpr int value = LUA_TFUNCTION;
+};
+
+template <typename T, typename A>
+struct _param_type<std::vector<T, A>> {
+    static constexpr int value = LUA_TTABLE;
+};
+
+template <typename T, std::size_t N>
+struct _param_type<std::array<T, N>> {
+    static constexpr int value = LUA_TTABLE;
+};
+
+template <typename K, typename V, typename C, typename A>
+struct _param_type<std::map<K, V, C, A>> {
+    static constexpr int value = LUA_TTABLE;
+};
+
+template <typename K, typename V, typename H, typename E, typename A>
+struct _param_type<std::unordered_map<K, V, H, E, A>> {
+    static constexpr int value = LUA_TTABLE;
+};
+
+template <typename T1, typename T2>
+struct _param_type<std::pair<T1, T2>> {
+    static constexpr int value = LUA_TTABLE;
+};
+
+template <>
+struct _param_type<Value> {
+    static constexpr int value = LUA_TNONE;
+};
+
+template <>
+struct _param_type<Varargs> {
+    static constexpr int value = LUA_TNONE;
+};
+
+template <typename T>
+struct _param_code {
+    static constexpr int type = _param_type<
+        typename std::remove_cv<typename std::remove_reference<T>::type>::type
+        >::value;
+};
+
+// Whether the last parameter is a sel::Varargs
+template <typename... Args>
+struct _variadic : std::false_type {};
+
+template <typename T>
+struct _variadic<T> : std::is_same<
+    typename std::remove_cv<typename std::remove_reference<T>::type>::type,
+    Varargs> {};
+
+template <typename T, typename U, typename... Rest>
+struct _variadic<T, U, Rest...> : _variadic<U, Rest...> {};
+
+template <typename T>
+inline int _add_param(std::uint64_t &signature, std::uint64_t &mask, int i) {
+    const int type = _param_code<T>::type;
+    if (i < _signature_args && type != LUA_TNONE) {
+        signature |= _type_code(type) << (4 * i);
+        mask |= std::uint64_t{0xf} << (4 * i);
+    }
+    return 0;
+}
+
+template <typename... Args, std::size_t... N>
+inline void _signature(std::uint64_t &signature, std::uint64_t &mask,
+                       _indices<N...>) {
+    int expand[] = {0, _add_param<Args>(signature, mask, N)...};
+    (void)expand;
+}
+}
+
+class OverloadSet : public BaseFun {
+private:
+    struct Candidate {
+        std::uint64_t signature;
+        std::uint64_t mask;
+        std::unique_ptr<BaseFun> fun;
+        // Arguments before the Varargs, for variadic candidates
+        int fixed;
+    };
+    // Indexed by arity
+    std::vector<std::vector<Candidate>> _candidates;
+    std::vector<Candidate> _variadic;
+    std::string _name;
+    const detail::StateBlock &_state;
+
+    // Built on the Lua stack since lua_error does not unwind C++ frames
+    int _no_match(lua_State *l, int n) {
+        // A type name and a separator per argument, the location and the
+        // parentheses
+        luaL_checkstack(l, 2 * n + 2, "too many arguments");
+        luaL_where(l, 1);
+        lua_pushfstring(l, "no overload of '%s' takes (", _name.c_str());
+        for (int i = 1; i <= n; ++i) {
+            lua_pushstring(l, luaL_typename(l, i));
+            if (i < n) lua_pushliteral(l, ", ");
+        }
+        lua_pushliteral(l, ")");
+        lua_concat(l, n > 0 ? 2 * n + 2 : 3);
+        return lua_error(l);
+    }
+
+public:
+    OverloadSet(const detail::StateBlock &state, const std::string &name)
+        : _name(name), _state(state) {}
+
+    template <typename Ret, typename... Args>
+    void Add(MetatableRegistry &metatables, std::function<Ret(Args...)> fun) {
+        constexpr int arity = detail::_arity<Ret>::value;
+        Candidate candidate{0, 0, nullptr, 0};
+        detail::_signature<Args...>(
+            candidate.signature, candidate.mask,
+            typename detail::_indices_builder<sizeof...(Args)>::type{});
+        candidate.fun.reset(
+            new Fun<arity, Ret, Args...>(_state, metatables, std::move(fun)));
+        if (detail::_variadic<Args...>::value) {
+            candidate.fixed = static_cast<int>(sizeof...(Args)) - 1;
+            _variadic.push_back(std::move(candidate));
+            return;
+        }
+        if (_candidates.size() <= sizeof...(Args)) {
+            _candidates.resize(sizeof...(Args) + 1);
+        }
+        _candidates[sizeof...(Args)].push_back(std::move(candidate));
+    }
+
+    int Apply() override {
+        lua_State *l = _state.GetState();
+        const int n = lua_gettop(l);
+        std::uint64_t signature = 0;
+        const int checked = n < detail::_signature_args
+            ? n : detail::_signature_args;
+        for (int i = 0; i < checked; ++i) {
+            signature |= detail::_type_code(lua_type(l, i + 1)) << (4 * i);
+        }
+        if (static_cast<std::size_t>(n) < _candidates.size()) {
+            for (auto &candidate : _candidates[n]) {
+                if ((signature & candidate.mask) == candidate.signature) {
+                    return candidate.fun->Apply();
+                }
+            }
+        }
+        for (auto &candidate : _variadic) {
+            if (candidate.fixed <= n &&
+                (signature & candidate.mask) == candidate.signature) {
+                return candidate.fun->Apply();
+            }
+        }
+        return _no_match(l, n);
+    }
+};
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include "BaseFun.h"
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+}
+
+namespace sel {
+/*
+ * Sampling profiler for Lua code. A timer thread wakes once per
+ * interval and arms a one-shot count hook with lua_sethook, which Lua
+ * allows to be called asynchronously. The hook fires on the next VM
+ * instruction, records the call stack and disarms itself, so no hook
+ * is installed between samples. Stacks are written in the folded
+ * format read by flamegraph.pl: frames root first, separated by ';',
+ * followed by the number of samples.
+ *
+ * Lua frames are written as name@source:line, C functions as
+ * name@[C] and functions bound through Selene as name@[C++]. Time
+ * spent inside C or C++ code executes no Lua instructions, so it is
+ * attributed to whichever Lua frame runs next. Only the main thread is
+ * hooked; code running inside coroutines is not sampled. A hook set
+ * before Start is put back after each sample and by Stop, though it
+ * misses the events between arming and the sample.
+ */
+class Profiler {
+private:
+    lua_State *_l;
+    std::chrono::microseconds _interval;
+    std::map<std::string, std::size_t> _samples;
+    std::vector<std::string> _frames;
+
+    std::thread _timer;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    bool _running = false;
+
+    // The hook found when profiling started
+    lua_Hook _saved_hook = nullptr;
+    int _saved_mask = 0;
+    int _saved_count = 0;
+
+    static char *_key() {
+        static char key;
+        return &key;
+    }
+
+    static void _hook(lua_State *l, lua_Debug *) {
+        lua_pushlightuserdata(l, _key());
+        lua_rawget(l, LUA_REGISTRYINDEX);
+        Profiler *profiler = (Profiler *)lua_touserdata(l, -1);
+        lua_pop(l, 1);
+        if (profiler == nullptr) {
+            lua_sethook(l, nullptr, 0, 0);
+            return;
+        }
+        profiler->_restore_hook();
+        profiler->_sample(l);
+    }
+
+    void _restore_hook() {
+        lua_sethook(_l, _saved_hook, _saved_mask, _saved_count);
+    }
+
+    static void _frame_name(std::string &frame, lua_Debug &ar, bool binding) {
+        frame.assign(ar.name ? ar.name : "?");
+        if (binding) {
+            frame += "@[C++]";
+        } else if (ar.what[0] == 'C') {
+            frame += "@[C]";
+        } else {
+            if (ar.what[0] == 'm') frame.assign("main");
+            frame += '@';
+            frame += ar.short_src;
+            frame += ':';
+            frame += std::to_string(ar.linedefined);
+        }
+    }
+
+    void _sample(lua_State *l) {
+        lua_Debug ar;
+        std::size_t depth = 0;
+        for (int level = 0; lua_getstack(l, level, &ar); ++level) {
+            lua_getinfo(l, "Snf", &ar);
+            bool binding = detail::_is_binding(l);
+            lua_pop(l, 1);
+            if (_frames.size() <= depth) _frames.emplace_back();
+            _frame_name(_frames[depth++], ar, binding);
+        }
+        std::string stack;
+        for (std::size_t i = depth; i > 0; --i) {
+            stack += _frames[i - 1];
+            if (i > 1) stack += ';';
+        }
+        ++_samples[stack];
+    }
+
+    void _set_registry(void *value) {
+        lua_pushlightuserdata(_l, _key());
+        lua_pushlightuserdata(_l, value);
+        lua_rawset(_l, LUA_REGISTRYINDEX);
+    }
+
+    void _run() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (!_wake.wait_for(lock, _interval, [this] { return !_running; })) {
+            lua_sethook(_l, &_hook, LUA_MASKCOUNT, 1);
+        }
+    }
+
+public:
+    Profiler(lua_State *l, std::chrono::microseconds interval)
+        : _l(l), _interval(interval) {}
+    Profiler(const Profiler &) = delete;
+    Profiler &operator=(const Profiler &) = delete;
+    ~Profiler() {
+        Stop();
+    }
+
+    void Start() {
+        if (_running) return;
+        _saved_hook = lua_gethook(_l);
+        _saved_mask = lua_gethookmask(_l);
+        _saved_count = lua_gethookcount(_l);
+        _set_registry(this);
+        _running = true;
+        _timer = std::thread([this] { _run(); });
+    }
+
+    void Stop() {
+        if (!_running) return;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _running = false;
+        }
+        _wake.notify_one();
+        _timer.join();
+        _restore_hook();
+        _set_registry(nullptr);
+    }
+
+    std::size_t SampleCount() const {
+        std::size_t count = 0;
+        for (const auto &sample : _samples) count += sample.second;
+        return count;
+    }
+
+    void WriteFolded(std::ostream &os) const {
+        for (const auto &sample : _samples) {
+            os << sample.first << ' ' << sample.second << '\n';
+        }
+    }
+};
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include "LuaRef.h"
+#include "MetatableRegistry.h"
+#include <string>
+#include <vector>
+
+namespace sel {
+namespace detail {
+
+/*
+ * The properties of a class, looked up by name in a perfect hash table
+ * built once all of them are registered. Each entry reads or writes one
+ * member of the object directly.
+ */
+class PropertyTable {
+public:
+    using Getter = void (*)(const StateBlock &, void *);
+    using Setter = void (*)(const StateBlock &, void *, int);
+
+    struct Entry {
+        std::string name;
+        Getter get;
+        // Null for read-only properties
+        Setter set;
+        // Null for properties of the class itself
+        const Upcast *upcast;
+    };
+
+private:
+    const StateBlock &_state;
+    const Metatable &_metatable;
+    std::vector<Entry> _entries;
+    // Index into _entries, or -1 for an empty slot
+    std::vector<int> _slots;
+    std::uint32_t _seed = 0;
+    std::uint32_t _mask = 0;
+
+    // FNV-1a with the seed folded into the offset basis
+    static std::uint32_t _hash(const char *key, std::size_t len,
+                               std::uint32_t seed) {
+        std::uint32_t h = 2166136261u ^ seed;
+        for (std::size_t i = 0; i < len; ++i) {
+            h ^= static_cast<unsigned char>(key[i]);
+            h *= 16777619u;
+        }
+        return h;
+    }
+
+    bool _try_seed(std::uint32_t seed) {
+        std::fill(_slots.begin(), _slots.end(), -1);
+        for (std::size_t i = 0; i < _entries.size(); ++i) {
+            const std::string &name = _entries[i].name;
+            int &slot = _slots[_hash(name.data(), name.size(), seed) & _mask];
+            if (slot != -1) return false;
+            slot = static_cast<int>(i);
+        }
+        _seed = seed;
+        return true;
+    }
+
+public:
+    PropertyTable(const StateBlock &state, const Metatable &metatable)
+        : _state(state), _metatable(metatable) {}
+
+    const StateBlock &State() const {
+        return _state;
+    }
+
+    const Metatable &GetMetatable() const {
+        return _metatable;
+    }
+
+    bool Empty() const {
+        return _entries.empty();
+    }
+
+    const std::vector<Entry> &Entries() const {
+        return _entries;
+    }
+
+    bool Has(const std::string &name) const {
+        for (const Entry &entry : _entries) {
+            if (entry.name == name) return true;
+        }
+        return false;
+    }
+
+    // Replaces a property of the same name, so that a class overrides
+    // the properties it inherits
+    void Add(const std::string &name, Getter get, Setter set,
+             const Upcast *upcast = nullptr) {
+        for (Entry &entry : _entries) {
+            if (entry.name == name) {
+                entry = Entry{name, get, set, upcast};
+                return;
+            }
+        }
+        _entries.push_back(Entry{name, get, set, upcast});
+    }
+
+    // Picks a table size of at least twice the number of entries and a
+    // seed with no collisions, growing the table when no seed works
+    void Build() {
+        std::size_t size = 1;
+        while (size < 2 * _entries.size()) size *= 2;
+        for (;; size *= 2) {
+            _slots.assign(size, -1);
+            _mask = static_cast<std::uint32_t>(size - 1);
+            for (std::uint32_t seed = 0; seed < 256; ++seed) {
+                if (_try_seed(seed)) return;
+            }
+        }
+    }
+
+    const Entry *Find(const char *key, std::size_t len) const {
+        const int i = _slots[_hash(key, len, _seed) & _mask];
+        if (i < 0) return nullptr;
+        const Entry &entry = _entries[i];
+        if (entry.name.size() != len ||
+            std::memcmp(entry.name.data(), key, len) != 0) {
+            return nullptr;
+        }
+        return &entry;
+    }
+};
+
+// __index of classes with properties. Upvalue 1 is the PropertyTable
+// and upvalue 2 the metatable, holding the methods.
+inline int _property_index(lua_State *l) {
+    auto *table = static_cast<const PropertyTable *>(
+        lua_touserdata(l, lua_upvalueindex(1)));
+    void *object = _check_udata(l, 1, table->GetMetatable());
+    if (lua_type(l, 2) == LUA_TSTRING) {
+        std::size_t len;
+        const char *key = lua_tolstring(l, 2, &len);
+        if (const PropertyTable::Entry *entry = table->Find(key, len)) {
+            entry->get(table->State(), _upcast(entry->upcast, object));
+            return 1;
+        }
+    }
+    lua_pushvalue(l, 2);
+    lua_rawget(l, lua_upvalueindex(2));
+    return 1;
+}
+
+// __newindex of classes with properties. Upvalue 1 is the
+// PropertyTable.
+inline int _property_newindex(lua_State *l) {
+    auto *table = static_cast<const PropertyTable *>(
+        lua_touserdata(l, lua_upvalueindex(1)));
+    void *object = _check_udata(l, 1, table->GetMetatable());
+    std::size_t len = 0;
+    const char *key = lua_type(l, 2) == LUA_TSTRING
+        ? lua_tolstring(l, 2, &len) : nullptr;
+    const PropertyTable::Entry *entry =
+        key != nullptr ? table->Find(key, len) : nullptr;
+    if (entry == nullptr) {
+        return luaL_error(l, "%s has no property '%s'",
+                          table->GetMetatable().name.c_str(),
+                          key != nullptr ? key : luaL_typename(l, 2));
+    }
+    if (entry->set == nullptr) {
+        return luaL_error(l, "property '%s' is read-only", key);
+    }
+    entry->set(table->State(), _upcast(entry->upcast, object), 3);
+    return 0;
+}
+}
+}
@@ -4,6 +4,7 @@
 #include "exotics.h"
 #include "Fun.h"
 #include "Obj.h"
+#include "Overload.h"
 #include <vector>
 
 namespace sel {
@@ -44,7 +45,6 @@ class StateBlock;
 class Registry {
 private:
     MetatableRegistry _metatables;
-    std::vector<std::unique_ptr<BaseFun>> _funs;
     std::vector<std::unique_ptr<BaseObj>> _objs;
     std::vector<std::unique_ptr<BaseClass>> _classes;
     const detail::StateBlock &_stateBlock;
@@ -52,42 +52,88 @@ public:
     Registry(detail::StateBlock &stateBlock):_stateBlock(stateBlock) {}
     ~Registry() {}
 
+    MetatableRegistry &GetMetatables() {
+        return _metatables;
+    }
+
+    std::vector<PoolStats> GetPoolStats() const {
+        std::vector<PoolStats> ret;
+        for (const auto &c : _classes) {
+            if (const detail::BasePool *pool = c->GetPool()) {
+                ret.push_back(pool->Stats());
+            }
+        }
+        return ret;
+    }
+
     template <typename L>
-    void Register(L lambda) {
-        Register((typename detail::lambda_traits<L>::Fun)(lambda));
+    void Register(const std::string &name, L lambda) {
+        Register(name, (typename detail::lambda_traits<L>::Fun)(lambda));
     }
 
+    // Pushes a closure owning the function; the name labels it in
+    // instrumentation snapshots
     template <typename Ret, typename... Args>
-    void Register(std::function<Ret(Args...)> fun) {
+    void Register(const std::string &name, std::function<Ret(Args...)> fun) {
         constexpr int arity = detail::_arity<Ret>::value;
-        auto tmp = std::unique_ptr<BaseFun>(
-            new Fun<arity, Ret, Args...>{_stateBlock, _metatables, fun});
-        _funs.push_back(std::move(tmp));
+        detail::_push_owned_fun<Fun<arity, Ret, Args...>>(
+            _stateBlock, name, _stateBlock, _metatables, std::move(fun));
     }
 
     template <typename Ret, typename... Args>
-    void Register(Ret (*fun)(Args...)) {
+    void Register(const std::string &name, Ret (*fun)(Args...)) {
         constexpr int arity = detail::_arity<Ret>::value;
-        auto tmp = std::unique_ptr<BaseFun>(
-            new Fun<arity, Ret, Args...>{_stateBlock, _metatables, fun});
-        _funs.push_back(std::move(tmp));
+        detail::_push_owned_fun<Fun<arity, Ret, Args...>>(
+            _stateBlock, name, _stateBlock, _metatables, fun);
+    }
+
+    template <typename... Fs>
+    void Register(const std::string &name, const Overloads<Fs...> &overloads) {
+        OverloadSet *set = detail::_push_owned_fun<OverloadSet>(
+            _stateBlock, name, _stateBlock, name);
+        _add_overloads(*set, overloads.funs,
+                       typename detail::_indices_builder<sizeof...(Fs)>::type{});
+    }
+
+    template <typename... Fs, size_t... N>
+    void _add_overloads(OverloadSet &set, const std::tuple<Fs...> &funs,
+                        detail::_indices<N...>) {
+        // Expanded in an initializer list to keep registration order
+        int expand[] = {0, (_add_overload(set, std::get<N>(funs)), 0)...};
+        (void)expand;
+    }
+
+    template <typename L>
+    void _add_overload(OverloadSet &set, L lambda) {
+        _add_overload(set, (typename detail::lambda_traits<L>::Fun)(lambda));
+    }
+
+    template <typename Ret, typename... Args>
+    void _add_overload(OverloadSet &set, std::function<Ret(Args...)> fun) {
+        set.Add(_metatables, std::move(fun));
+    }
+
+    template <typename Ret, typename... Args>
+    void _add_overload(OverloadSet &set, Ret (*fun)(Args...)) {
+        set.Add(_metatables, std::function<Ret(Args...)>(fun));
     }
 
     template <typename T, typename... Funs>
-    void Register(T &t, std::tuple<Funs...> funs) {
-        Register(t, funs,
+    void Register(const std::string &name, T &t, std::tuple<Funs...> funs) {
+        Register(name, t, funs,
                  typename detail::_indices_builder<sizeof...(Funs)>::type{});
     }
 
     template <typename T, typename... Funs, size_t... N>
-    void Register(T &t, std::tuple<Funs...> funs, detail::_indices<N...>) {
-        RegisterObj(t, std::get<N>(funs)...);
+    void Register(const std::string &name, T &t, std::tuple<Funs...> funs,
+                  detail::_indices<N...>) {
+        RegisterObj(name, t, std::get<N>(funs)...);
     }
 
     template <typename T, typename... Funs>
-    void RegisterObj(T &t, Funs... funs) {
+    void RegisterObj(const std::string &name, T &t, Funs... funs) {
         auto tmp = std::unique_ptr<BaseObj>(
-            new Obj<T, Funs...>{_stateBlock, &t, funs...});
+            new Obj<T, Funs...>{_stateBlock, name, &t, funs...});
         _objs.push_back(std::move(tmp));
     }
 
@@ -107,13 +153,24 @@ public:
 };
 
 namespace detail {
+inline MetatableRegistry &_metatables(const StateBlock &state) {
+    return state.GetRegistry()->GetMetatables();
+}
+
 inline StateBlock::StateBlock(lua_State *state, bool owned):_state(state),_owned(owned) {
     _registry = new Registry(*this);
 }
 inline StateBlock::~StateBlock() {
+    if (!_owned && _handler_ref != LUA_NOREF) {
+        luaL_unref(_state, LUA_REGISTRYINDEX, _handler_ref);
+    }
+    if (!_owned) EnableIdentityCache(false);
     if(_owned) {
         lua_gc(_state, LUA_GCCOLLECT, 0);
         lua_close(_state);
+        // Tells the classes deleted with the registry that their refs
+        // went with the state
+        _state = nullptr;
     }
     delete _registry;
 }
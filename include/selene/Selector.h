@@ -1,19 +1,27 @@
 #pragma once
 
+#include <array>
+#include "containers.h"
 #include "exotics.h"
 #include <functional>
+#include <map>
+#include "NumArray.h"
 #include "Registry.h"
+#include "StaticFun.h"
 #include "Value.h"
 #include <string>
 #include <tuple>
+#include <unordered_map>
 #include <vector>
 
 #include "util.h"
 
 namespace sel {
 class State;
+class Environment;
 class Selector {
     friend class State;
+    friend class Environment;
 private:
     std::shared_ptr<const detail::StateBlock> _state;
     std::string _name;
@@ -34,13 +42,22 @@ private:
     using Functor = std::function<void(int)>;
     mutable Functor _functor;
 
+    // The stack height when the selector was made, which every access
+    // returns to. Inside a binding this keeps the binding's arguments.
+    int _base;
+
+    void _flush() const {
+        lua_State *l = _state->GetState();
+        if (lua_gettop(l) > _base) lua_settop(l, _base);
+    }
+
     Selector(const std::shared_ptr<const detail::StateBlock> &s, const std::string &name,
-             std::vector<Fun> traversal, Fun get, PFun put)
+             std::vector<Fun> traversal, Fun get, PFun put, int base)
         : _state(s),  _name(name), _traversal{traversal},
-          _get(get), _put(put) {}
+          _get(get), _put(put), _base(base) {}
     
     Selector(const std::shared_ptr<const detail::StateBlock> &s, const std::string &name)
-    : _state(s), _name(name) {
+    : _state(s), _name(name), _base(lua_gettop(s->GetState())) {
         _get = [this, name]() {
             lua_getglobal(_state->GetState(), name.c_str());
         };
@@ -52,7 +69,7 @@ private:
 
     template<size_t SIZE>
     Selector(const std::shared_ptr<const detail::StateBlock> &s, const char (&name)[SIZE])
-        : _state(s), _name(name) {
+        : _state(s), _name(name), _base(lua_gettop(s->GetState())) {
         _get = [this, name]() {
             lua_getglobal(_state->GetState(), name);
         };
@@ -62,6 +79,24 @@ private:
         };
     }
 
+    // Selects a field of the table referenced by env rather than a global
+    Selector(const std::shared_ptr<const detail::StateBlock> &s, const LuaRef &env,
+             const std::string &name)
+        : _state(s), _name(name), _base(lua_gettop(s->GetState())) {
+        _traversal.push_back([env]() {
+            env.Push();
+        });
+        lua_State *l = s->GetState();
+        _get = [l, name]() {
+            lua_getfield(l, -1, name.c_str());
+        };
+        _put = [l, name](Fun fun) {
+            fun();
+            lua_setfield(l, -2, name.c_str());
+            lua_pop(l, 1);
+        };
+    }
+
     void _check_create_table() const {
         _traverse();
         _get();
@@ -86,17 +121,17 @@ private:
     void _put_val(const T &functor) {
         _traverse();
         auto push = [this, functor]() {
-            _state->GetRegistry()->Register(functor);
+            _state->GetRegistry()->Register(_name, functor);
         };
         _put(push);
-        lua_settop(_state->GetState(), 0);
+        _flush();
     }
     
     template <typename Ret, typename... Args>
     void _put_val(Ret (*fun)(Args...)) {
         _traverse();
         auto push = [this, fun]() {
-            _state->GetRegistry()->Register(fun);
+            _state->GetRegistry()->Register(_name, fun);
         };
         _put(push);
     }
@@ -105,7 +140,7 @@ private:
     void _put_val(const std::function<Ret(Args...)> &fun) {
         _traverse();
         auto push = [this, fun]() {
-            _state->GetRegistry()->Register(fun);
+            _state->GetRegistry()->Register(_name, fun);
         };
         _put(push);
     }
@@ -117,7 +152,7 @@ private:
             detail::_push(*_state.get(), i);
         };
         _put(push);
-        lua_settop(_state->GetState(), 0);
+        _flush();
     }
     
     void _put_val(const std::string &str) {
@@ -126,7 +161,7 @@ private:
             detail::_push(*_state.get(), str);
         };
         _put(push);
-        lua_settop(_state->GetState(), 0);
+        _flush();
     }
     
     void _put_val(const Value &value) {
@@ -135,7 +170,30 @@ private:
             detail::_push(*_state.get(), value);
         };
         _put(push);
-        lua_settop(_state->GetState(), 0);
+        _flush();
+    }
+
+    // Containers are converted to a table in place, without a copy
+    template <typename C>
+    void _put_container(const C &container) {
+        _traverse();
+        auto push = [this, &container]() {
+            detail::_push(*_state.get(), container);
+        };
+        _put(push);
+        _flush();
+    }
+
+    template <typename P>
+    void _put_owner(P &&pointer) {
+        _traverse();
+        auto push = [this, &pointer]() {
+            detail::_push(*_state.get(),
+                          _state->GetRegistry()->GetMetatables(),
+                          std::move(pointer));
+        };
+        _put(push);
+        _flush();
     }
     
     template <typename T>
@@ -147,7 +205,7 @@ private:
             _functor = nullptr;
         }
         auto ret = detail::_pop(detail::_id<T>{}, *_state.get());
-        lua_settop(_state->GetState(), 0);
+        _flush();
         return ret;
     }
     
@@ -184,7 +242,8 @@ public:
           _traversal{other._traversal},
           _get{other._get},
           _put{other._put},
-          _functor(other._functor)
+          _functor(other._functor),
+          _base(other._base)
         {}
 
     ~Selector() {
@@ -194,7 +253,7 @@ public:
             _get();
             _functor(0);
         }
-        lua_settop(_state->GetState(), 0);
+        _flush();
     }
 
     // Allow automatic casting when used in comparisons
@@ -203,28 +262,13 @@ public:
     template <typename... Args>
     const Selector operator()(Args... args) const {
         auto tuple_args = std::make_tuple(std::forward<Args>(args)...);
-        constexpr int num_args = sizeof...(Args);
         Selector copy{*this};
-        copy._functor = [this, tuple_args, num_args](int num_ret) {
-            // install handler, and swap(handler, function) on lua stack
-            int handler_index = SetErrorHandler(_state->GetState());
-            int func_index = handler_index - 1;
-#if LUA_VERSION_NUM >= 502
-            lua_pushvalue(_state->GetState(), func_index);
-            lua_copy(_state->GetState(), handler_index, func_index);
-            lua_replace(_state->GetState(), handler_index);
-#else
-            lua_pushvalue(_state->GetState(), func_index);
-            lua_push_value(_state->GetState(), handler_index);
-            lua_replace(_state->GetState(), func_index);
-            lua_replace(_state->GetState(), handler_index);
-#endif
-            // call lua function with error handler
+        copy._functor = [this, tuple_args](int num_ret) {
+            // Counted from the stack since Varargs push any number of values
+            const int base = lua_gettop(_state->GetState());
             detail::_push(*_state.get(), tuple_args);
-            lua_pcall(_state->GetState(), num_args, num_ret, handler_index - 1);
-
-            // remove error handler
-            lua_remove(_state->GetState(), handler_index - 1);
+            detail::_pcall(*_state, lua_gettop(_state->GetState()) - base,
+                           num_ret);
         };
         return copy;
     }
@@ -243,6 +287,26 @@ public:
     void operator=(const std::function<Ret(Args...)> &fun) {
         _put_val(fun);
     }
+
+    template <typename... Fs>
+    void operator=(const Overloads<Fs...> &overloads) {
+        _traverse();
+        auto push = [this, &overloads]() {
+            _state->GetRegistry()->Register(_name, overloads);
+        };
+        _put(push);
+        _flush();
+    }
+
+    template <typename F, F f>
+    void operator=(Fn<F, f>) {
+        _traverse();
+        auto push = [this]() {
+            Fn<F, f>::Push(*_state, _name);
+        };
+        _put(push);
+        _flush();
+    }
     
     template <typename T, typename std::enable_if<std::is_integral<T>::value >::type* = 0>
     void operator=(T i) {
@@ -260,15 +324,62 @@ public:
         _put_val(std::string(s));
     }
 
+    template <typename T, typename A>
+    void operator=(const std::vector<T, A> &v) {
+        _put_container(v);
+    }
+
+    template <typename T, std::size_t N>
+    void operator=(const std::array<T, N> &a) {
+        _put_container(a);
+    }
+
+    template <typename K, typename V, typename C, typename A>
+    void operator=(const std::map<K, V, C, A> &m) {
+        _put_container(m);
+    }
+
+    template <typename K, typename V, typename H, typename E, typename A>
+    void operator=(const std::unordered_map<K, V, H, E, A> &m) {
+        _put_container(m);
+    }
+
+    template <typename T1, typename T2>
+    void operator=(const std::pair<T1, T2> &p) {
+        _put_container(p);
+    }
+
+    template <typename C>
+    void operator=(const ContainerRef<C> &ref) {
+        _put_container(ref);
+    }
+
+    template <typename T>
+    void operator=(const NumArray<T> &array) {
+        _put_container(array);
+    }
+
+    // Lua shares ownership of the object
+    template <typename T>
+    void operator=(std::shared_ptr<T> pointer) {
+        _put_owner(std::move(pointer));
+    }
+
+    // Lua takes ownership of the object
+    template <typename T, typename D>
+    void operator=(std::unique_ptr<T, D> pointer) {
+        _put_owner(std::move(pointer));
+    }
+
     template <typename T, typename... Funs>
     void SetObj(T &t, Funs... funs) {
         _traverse();
         auto fun_tuple = std::make_tuple(funs...);
         auto push = [this, &t, &fun_tuple]() {
-            _state->GetRegistry()->Register(t, fun_tuple);
+            _state->GetRegistry()->Register(_name, t, fun_tuple);
         };
         _put(push);
-        lua_settop(_state->GetState(), 0);
+        _flush();
     }
 
     template <typename T, typename... Args, typename... Funs>
@@ -280,7 +391,7 @@ public:
             _state->GetRegistry()->RegisterClass<T, Args...>(_name, fun_tuple, d);
         };
         _put(push);
-        lua_settop(_state->GetState(), 0);
+        _flush();
     }
 
     template <typename... Ret>
@@ -288,7 +399,9 @@ public:
         _traverse();
         _get();
         _functor(sizeof...(Ret));
-        return detail::_pop_n_reset<Ret...>(*_state.get());
+        std::tuple<Ret...> ret(detail::_pop_n<Ret...>(*_state.get()));
+        _flush();
+        return ret;
     }
 
     template <typename T>
@@ -337,6 +450,46 @@ public:
         return _get_val<Value>();
     }
 
+    template <typename T, typename A>
+    operator std::vector<T, A>() const {
+        return _get_val<std::vector<T, A>>();
+    }
+
+    template <typename T, std::size_t N>
+    operator std::array<T, N>() const {
+        return _get_val<std::array<T, N>>();
+    }
+
+    template <typename K, typename V, typename C, typename A>
+    operator std::map<K, V, C, A>() const {
+        return _get_val<std::map<K, V, C, A>>();
+    }
+
+    template <typename K, typename V, typename H, typename E, typename A>
+    operator std::unordered_map<K, V, H, E, A>() const {
+        return _get_val<std::unordered_map<K, V, H, E, A>>();
+    }
+
+    template <typename T1, typename T2>
+    operator std::pair<T1, T2>() const {
+        return _get_val<std::pair<T1, T2>>();
+    }
+
+    template <typename C>
+    operator ContainerRef<C>() const {
+        return _get_val<ContainerRef<C>>();
+    }
+
+    template <typename T>
+    operator NumArray<T>() const {
+        return _get_val<NumArray<T>>();
+    }
+
+    template <typename T>
+    operator std::shared_ptr<T>() const {
+        return _get_val<std::shared_ptr<T>>();
+    }
+
     template <typename R, typename... Args>
     operator sel::function<R(Args...)>() {
         _traverse();
@@ -346,8 +499,8 @@ public:
             _functor = nullptr;
         }
         auto ret = detail::_pop(detail::_id<sel::function<R(Args...)>>{},
-                                _state);
-        lua_settop(_state->GetState(), 0);
+                                *_state);
+        _flush();
         return ret;
     }
     
@@ -462,7 +615,7 @@ public:
         
         for(size_t i=0;i<names.size();++i)
         {
-            ret.emplace_back(Selector{_state, names[i], traversal, get1[i], put1[i]}, Selector{_state, names[i], traversal, get2[i], put2[i]});
+            ret.emplace_back(Selector{_state, names[i], traversal, get1[i], put1[i], _base}, Selector{_state, names[i], traversal, get2[i], put2[i], _base});
         }
         return ret;
     }
@@ -528,7 +681,7 @@ public:
             lua_setfield(_state->GetState(), -2, name);
             lua_pop(_state->GetState(), 1);
         };
-        return Selector{_state, n, traversal, get, put};
+        return Selector{_state, n, traversal, get, put, _base};
     }
     Selector operator[](const std::string &name) const & {
         auto n = _name + "." + name;
@@ -543,7 +696,7 @@ public:
             lua_setfield(_state->GetState(), -2, name.c_str());
             lua_pop(_state->GetState(), 1);
         };
-        return Selector{_state, n, traversal, get, put};
+        return Selector{_state, n, traversal, get, put, _base};
     }
     Selector operator[](const double index) const & {
         auto name = _name + "." + std::to_string(index);
@@ -560,7 +713,7 @@ public:
             lua_settable(_state->GetState(), -3);
             lua_pop(_state->GetState(), 1);
         };
-        return Selector{_state, name, traversal, get, put};
+        return Selector{_state, name, traversal, get, put, _base};
     }
 
     friend bool operator==(const Selector &, const char *);
@@ -576,7 +729,7 @@ private:
             _functor = nullptr;
         }
         auto ret =  detail::_pop(detail::_id<std::string>{}, *_state.get());
-        lua_settop(_state->GetState(), 0);
+        _flush();
         return ret;
     }
 };
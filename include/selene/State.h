@@ -1,7 +1,10 @@
 #pragma once
 
+#include <chrono>
+#include "Environment.h"
 #include <iostream>
 #include <memory>
+#include "Profiler.h"
 #include <stdexcept>
 #include <string>
 #include "Registry.h"
@@ -20,6 +23,7 @@ inline int atpanic(lua_State* l)
 class State {
 private:
     std::shared_ptr<const detail::StateBlock> _stateBlock;
+    std::unique_ptr<Profiler> _profiler;
 
 public:
     State() : State(false) {}
@@ -33,11 +37,13 @@ public:
     }
     State(const State &other) = delete;
     State &operator=(const State &other) = delete;
-    State(State &&other): _stateBlock(other._stateBlock){
+    State(State &&other)
+        : _stateBlock(other._stateBlock), _profiler(std::move(other._profiler)) {
         other._stateBlock.reset();
     }
     State &operator=(State &&other) {
         if (&other == this) return *this;
+        _profiler = std::move(other._profiler);
         _stateBlock = other._stateBlock;
         other._stateBlock.reset();
         return *this;
@@ -50,29 +56,7 @@ public:
     }
 
     bool Load(const std::string &file) {
-        int status = luaL_loadfile(_stateBlock->GetState(), file.c_str());
-#if LUA_VERSION_NUM >= 502
-        if (status != LUA_OK) {
-#else
-        if (status != 0) {
-#endif
-            if (status == LUA_ERRSYNTAX) {
-                const char *msg = lua_tostring(_stateBlock->GetState(), -1);
-                _print(msg ? msg : (file + ": syntax error").c_str());
-            } else if (status == LUA_ERRFILE) {
-                const char *msg = lua_tostring(_stateBlock->GetState(), -1);
-                _print(msg ? msg : (file + ": file error").c_str());
-            }
-            lua_remove(_stateBlock->GetState() , -1);
-            return false;
-        }
-        if (!lua_pcall(_stateBlock->GetState(), 0, LUA_MULTRET, 0))
-            return true;
-
-        const char *msg = lua_tostring(_stateBlock->GetState(), -1);
-        _print(msg ? msg : (file + ": dofile failed").c_str());
-        lua_remove(_stateBlock->GetState(), -1);
-        return false;
+        return detail::_load(*_stateBlock, file);
     }
 
     void OpenLib(const std::string& modname, lua_CFunction openf) {
@@ -100,6 +84,12 @@ public:
         return detail::_get(detail::_id<T>{}, _stateBlock, index);
     }
 
+    // Creates a sandbox whose global namespace falls through to this
+    // state's globals for reads and keeps writes to itself.
+    Environment NewEnvironment() {
+        return Environment{*_stateBlock};
+    }
+
     bool CheckNil(const std::string &global) {
         lua_getglobal(_stateBlock->GetState(), global.c_str());
         const bool result = lua_isnil(_stateBlock->GetState(), -1);
@@ -117,19 +107,87 @@ public:
     }
 
     bool operator()(const char *code) {
-        bool result = !luaL_dostring(_stateBlock->GetState(), code);
-        if (result) lua_settop(_stateBlock->GetState(), 0);
+        const int top = lua_gettop(_stateBlock->GetState());
+        bool result = detail::_dostring(*_stateBlock, code);
+        if (result) lua_settop(_stateBlock->GetState(), top);
         return result;
     }
     bool operator()(const std::string &code) {
-        bool result = !luaL_dostring(_stateBlock->GetState(), code.c_str());
-        if (result) lua_settop(_stateBlock->GetState(), 0);
-        return result;
+        return (*this)(code.c_str());
+    }
+
+    // The last error raised while running code or calling a Lua
+    // function from C++
+    const LuaError &LastError() const {
+        return _stateBlock->GetLastError();
+    }
+
+    void ClearError() {
+        _stateBlock->GetLastError().Clear();
+    }
+
+    // Routes load, run and call errors at or above level to sink.
+    // Without a sink, errors are only kept in LastError(), except that
+    // Load also writes them to std::cout.
+    void SetDiagnosticsSink(std::shared_ptr<DiagnosticsSink> sink,
+                            LogLevel level = LogLevel::Warning) {
+        _stateBlock->SetDiagnosticsSink(std::move(sink), level);
+    }
+
+    // When enabled, failed calls also record a traceback of the Lua
+    // stack in LastError(). Off by default since it walks the stack on
+    // every error.
+    void EnableTracebacks(bool enable = true) {
+        _stateBlock->EnableTracebacks(enable);
+    }
+
+    // When enabled, a pointer or reference to an object already in Lua
+    // pushes the same userdata again instead of a new one, so repeated
+    // returns compare equal with ==. Off by default since every push
+    // of an object then does a table lookup.
+    void EnableIdentityCache(bool enable = true) {
+        _stateBlock->EnableIdentityCache(enable);
     }
     void ForceGC() {
         lua_gc(_stateBlock->GetState(), LUA_GCCOLLECT, 0);
     }
 
+    // Samples the Lua call stack roughly once per interval until
+    // StopProfiler is called. Restarting discards previous samples.
+    void StartProfiler(std::chrono::microseconds interval =
+                       std::chrono::microseconds{1000}) {
+        _profiler.reset(new Profiler(_stateBlock->GetState(), interval));
+        _profiler->Start();
+    }
+
+    void StopProfiler() {
+        if (_profiler) _profiler->Stop();
+    }
+
+    // Writes the samples collected so far as folded stacks
+    void WriteProfile(std::ostream &os) const {
+        if (_profiler) _profiler->WriteFolded(os);
+    }
+
+    // Call statistics of every binding, recorded only when compiled
+    // with SELENE_INSTRUMENT
+    std::vector<BindingStats> GetBindingStats() const {
+        return _stateBlock->GetInstrumentation().Snapshot();
+    }
+
+    void WriteBindingStats(std::ostream &os) const {
+        _stateBlock->GetInstrumentation().WriteText(os);
+    }
+
+    void ResetBindingStats() {
+        _stateBlock->GetInstrumentation().Reset();
+    }
+
+    // Occupancy of the pool of every class registered with sel::Pooled
+    std::vector<PoolStats> GetPoolStats() const {
+        return _stateBlock->GetRegistry()->GetPoolStats();
+    }
+
     void InteractiveDebug() {
         luaL_dostring(_stateBlock->GetState(), "debug.debug()");
     }
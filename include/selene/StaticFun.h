@@ -0,0 +1,61 @@
+#pragma once
+
+#include "BaseFun.h"
+#include "primitives.h"
+#include "Registry.h"
+#include <string>
+#include <type_traits>
+
+namespace sel {
+/*
+ * A free function bound at compile time:
+ *
+ *     state["add"] = sel::Fn<decltype(&add), &add>{};
+ *     state["add"] = sel::fn<&add>; // C++17
+ *
+ * Each bound function gets its own lua_CFunction, which reads the
+ * arguments straight off the stack and calls the target directly. There
+ * is no std::function, no virtual Apply and no heap-allocated binding;
+ * the only upvalue is the StateBlock.
+ */
+template <typename F, F f>
+struct Fn;
+
+template <typename Ret, typename... Args, Ret (*f)(Args...)>
+struct Fn<Ret (*)(Args...), f> {
+private:
+    template <std::size_t... N>
+    static int _apply(const detail::StateBlock &state, std::false_type,
+                      detail::_indices<N...>) {
+        detail::_push(state, state.GetRegistry()->GetMetatables(),
+                      f(detail::_check_get(detail::_id<Args>{}, state, N + 1)...));
+        return detail::_arity<Ret>::value;
+    }
+
+    template <std::size_t... N>
+    static int _apply(const detail::StateBlock &state, std::true_type,
+                      detail::_indices<N...>) {
+        f(detail::_check_get(detail::_id<Args>{}, state, N + 1)...);
+        return 0;
+    }
+
+public:
+    static int Call(lua_State *l) {
+        auto *state = static_cast<const detail::StateBlock *>(
+            lua_touserdata(l, lua_upvalueindex(1)));
+        return _apply(*state, std::is_void<Ret>{},
+                      typename detail::_indices_builder<sizeof...(Args)>::type());
+    }
+
+    static void Push(const detail::StateBlock &state, const std::string &label) {
+        lua_pushlightuserdata(state.GetState(),
+                              const_cast<detail::StateBlock *>(&state));
+        detail::_push_static<&Call, 1>(state, label);
+    }
+};
+
+#if __cplusplus >= 201703L
+template <auto f>
+constexpr Fn<decltype(f), f> fn{};
+#endif
+}
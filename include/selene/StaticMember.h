@@ -0,0 +1,247 @@
+#pragma once
+
+#include "BaseFun.h"
+#include "primitives.h"
+#include "PropertyTable.h"
+#include <type_traits>
+
+namespace sel {
+/*
+ * Members bound at compile time. Passed to SetClass or SetObj in place
+ * of a plain member pointer:
+ *
+ *     state["Foo"].SetClass<Foo>(
+ *         "bar", sel::Method<decltype(&Foo::bar), &Foo::bar>{},
+ *         "x", sel::Field<decltype(&Foo::x), &Foo::x>{});
+ *     state["Foo"].SetClass<Foo>("bar", sel::method<&Foo::bar>,
+ *                                "x", sel::field<&Foo::x>); // C++17
+ *
+ * Each member gets its own lua_CFunction calling it directly, with no
+ * std::function and no heap-allocated ClassFun or ObjFun behind it.
+ * Fields are exposed as x and set_x, like plain member pointers.
+ *
+ * Class fields can instead be bound as properties, read and written as
+ * obj.x and obj.x = v:
+ *
+ *     state["Foo"].SetClass<Foo>(
+ *         "x", sel::Property<decltype(&Foo::x), &Foo::x>{});
+ *     state["Foo"].SetClass<Foo>("x", sel::property<&Foo::x>); // C++17
+ *
+ * A class with properties gets one __index and one __newindex function
+ * that find the property in a perfect hash table. Method lookups go
+ * through the same __index and fall back to the metatable.
+ */
+template <typename F, F f>
+struct Method {};
+
+template <typename F, F f>
+struct Field {};
+
+template <typename F, F f>
+struct Property {};
+
+#if __cplusplus >= 201703L
+template <auto f>
+constexpr Method<decltype(f), f> method{};
+
+template <auto f>
+constexpr Field<decltype(f), f> field{};
+
+template <auto f>
+constexpr Property<decltype(f), f> property{};
+#endif
+
+namespace detail {
+
+// Upvalue 1 of every static member closure is the StateBlock; upvalue
+// 2 tells where the object comes from.
+
+// Class instances are passed as the first argument. Upvalue 2 is the
+// class Metatable.
+template <typename T>
+struct _class_self {
+    static constexpr int first_arg = 2;
+    static T *Get(lua_State *l) {
+        return (T *)_check_udata(l, 1, *static_cast<const Metatable *>(
+            lua_touserdata(l, lua_upvalueindex(2))));
+    }
+};
+
+// Registered objects are bound to their table. Upvalue 2 is the object.
+template <typename T>
+struct _obj_self {
+    static constexpr int first_arg = 1;
+    static T *Get(lua_State *l) {
+        return (T *)lua_touserdata(l, lua_upvalueindex(2));
+    }
+};
+
+inline const StateBlock &_static_state(lua_State *l) {
+    return *static_cast<const StateBlock *>(lua_touserdata(l, lua_upvalueindex(1)));
+}
+
+template <template <typename> class Self, typename T, typename F, F f,
+          typename Ret, typename... Args>
+struct _method_call {
+    template <std::size_t... N>
+    static int _apply(lua_State *l, std::false_type, _indices<N...>) {
+        const StateBlock &state = _static_state(l);
+        T *t = Self<T>::Get(l);
+        _push(state, _metatables(state),
+              (t->*f)(_check_get(_id<Args>{}, state, N + Self<T>::first_arg)...));
+        return _arity<Ret>::value;
+    }
+
+    template <std::size_t... N>
+    static int _apply(lua_State *l, std::true_type, _indices<N...>) {
+        const StateBlock &state = _static_state(l);
+        T *t = Self<T>::Get(l);
+        (t->*f)(_check_get(_id<Args>{}, state, N + Self<T>::first_arg)...);
+        return 0;
+    }
+
+    static int Call(lua_State *l) {
+        return _apply(l, std::is_void<Ret>{},
+                      typename _indices_builder<sizeof...(Args)>::type());
+    }
+};
+
+template <template <typename> class Self, typename F, F f>
+struct _method;
+
+template <template <typename> class Self, typename T, typename Ret,
+          typename... Args, Ret (T::*f)(Args...)>
+struct _method<Self, Ret (T::*)(Args...), f>
+    : _method_call<Self, T, Ret (T::*)(Args...), f, Ret, Args...> {};
+
+template <template <typename> class Self, typename T, typename Ret,
+          typename... Args, Ret (T::*f)(Args...) const>
+struct _method<Self, Ret (T::*)(Args...) const, f>
+    : _method_call<Self, T, Ret (T::*)(Args...) const, f, Ret, Args...> {};
+
+// Keys the registry table keeping objects alive for the boxes of their
+// members
+inline char *_anchor_key() {
+    static char key;
+    return &key;
+}
+
+// Keeps the userdata at index parent alive as long as the box on top of
+// the stack, when that box borrows its object, which then lives inside
+// the parent
+inline void _anchor_to(lua_State *l, int parent) {
+    if (lua_type(l, parent) != LUA_TUSERDATA || !_has_header(l, -1) ||
+        static_cast<Userdata *>(lua_touserdata(l, -1))->release != nullptr) {
+        return;
+    }
+    lua_pushlightuserdata(l, _anchor_key());
+    lua_rawget(l, LUA_REGISTRYINDEX);
+    if (lua_isnil(l, -1)) {
+        lua_pop(l, 1);
+        lua_newtable(l);
+        lua_newtable(l);
+        lua_pushliteral(l, "k");
+        lua_setfield(l, -2, "__mode");
+        lua_setmetatable(l, -2);
+        lua_pushlightuserdata(l, _anchor_key());
+        lua_pushvalue(l, -2);
+        lua_rawset(l, LUA_REGISTRYINDEX);
+    }
+    lua_pushvalue(l, -2);
+    lua_pushvalue(l, parent);
+    lua_rawset(l, -3);
+    lua_pop(l, 1);
+}
+
+// Pushes a member of the object at index 1. Members of class type are
+// boxed in place, so the box keeps the object alive.
+template <typename M>
+inline void _push_member(const StateBlock &state, const M &value) {
+    _push(state, _metatables(state), value);
+    if (std::is_class<M>::value) _anchor_to(state.GetState(), 1);
+}
+
+template <typename M, typename = void>
+struct _reads_by_value : std::false_type {};
+
+template <typename M>
+struct _reads_by_value<M, typename std::conditional<
+                              false,
+                              decltype(_check_get(_id<M>{},
+                                                  std::declval<const StateBlock &>(),
+                                                  0)),
+                              void>::type>
+    : std::true_type {};
+
+// The new value of a member. Registered classes have no by-value
+// reader; they are copied from the instance passed instead.
+template <typename M>
+inline M _check_member(const StateBlock &state, int index, std::true_type) {
+    return _check_get(_id<M>{}, state, index);
+}
+
+template <typename M>
+inline const M &_check_member(const StateBlock &state, int index,
+                              std::false_type) {
+    return _check_get(_id<M &>{}, state, index);
+}
+
+template <typename M>
+inline auto _check_member(const StateBlock &state, int index)
+    -> decltype(_check_member<M>(state, index, _reads_by_value<M>{})) {
+    return _check_member<M>(state, index, _reads_by_value<M>{});
+}
+
+// Members that cannot be assigned are read-only
+template <typename M>
+using _settable = std::integral_constant<
+    bool, !std::is_const<M>::value && std::is_copy_assignable<M>::value>;
+
+template <template <typename> class Self, typename F, F f>
+struct _field;
+
+template <template <typename> class Self, typename T, typename M, M T::*f>
+struct _field<Self, M T::*, f> {
+    using Settable = _settable<M>;
+
+    static int Get(lua_State *l) {
+        _push_member(_static_state(l), Self<T>::Get(l)->*f);
+        return 1;
+    }
+
+    static int Set(lua_State *l) {
+        T *t = Self<T>::Get(l);
+        t->*f = _check_member<M>(_static_state(l), Self<T>::first_arg);
+        return 0;
+    }
+};
+
+// Accessors stored in a PropertyTable, for an object already checked
+template <typename F, F f>
+struct _property;
+
+template <typename T, typename M, M T::*f>
+struct _property<M T::*, f> {
+    static void Get(const StateBlock &state, void *object) {
+        _push_member(state, static_cast<T *>(object)->*f);
+    }
+
+    static void Set(const StateBlock &state, void *object, int index) {
+        static_cast<T *>(object)->*f = _check_member<M>(state, index);
+    }
+
+    static PropertyTable::Setter Setter(std::true_type) {
+        return nullptr;
+    }
+
+    static PropertyTable::Setter Setter(std::false_type) {
+        return &Set;
+    }
+
+    // Null for members that cannot be assigned, which are read-only
+    static PropertyTable::Setter Setter() {
+        return Setter(std::integral_constant<bool, !_settable<M>::value>{});
+    }
+};
+}
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+}
+
+namespace sel {
+namespace detail {
+
+/*
+ * The start of every class instance block. object points to the
+ * instance, which follows the header when Lua owns it outright, or is
+ * owned by a smart pointer that follows the header instead. release is
+ * called once from __gc and identifies how the block holds the object;
+ * it is null when the block only borrows the object.
+ */
+struct Userdata {
+    void *object;
+    void (*release)(Userdata *);
+};
+
+// Marks the metatables of the blocks starting with a Userdata
+inline char *_header_key() {
+    static char key;
+    return &key;
+}
+
+// Marks the metatable on top of the stack
+inline void _mark_header(lua_State *l) {
+    lua_pushlightuserdata(l, _header_key());
+    lua_pushboolean(l, 1);
+    lua_rawset(l, -3);
+}
+
+inline bool _has_header(lua_State *l, int index) {
+    if (lua_type(l, index) != LUA_TUSERDATA || !lua_getmetatable(l, index)) {
+        return false;
+    }
+    lua_pushlightuserdata(l, _header_key());
+    lua_rawget(l, -2);
+    const bool header = lua_toboolean(l, -1) != 0;
+    lua_pop(l, 2);
+    return header;
+}
+
+// The instance behind a class userdata. Any other userdata, whose block
+// may hold anything, gives its block, and a light userdata its pointer.
+inline void *_to_object(lua_State *l, int index) {
+    void *udata = lua_touserdata(l, index);
+    if (udata == nullptr || !_has_header(l, index)) return udata;
+    return static_cast<Userdata *>(udata)->object;
+}
+
+// Lua aligns blocks for its own types, which is enough for the header.
+// What follows the header is placed at the next multiple of its
+// alignment, the block being grown to leave room for the padding.
+template <typename H>
+constexpr std::size_t _block_size() {
+    return sizeof(Userdata) + sizeof(H) +
+        (alignof(H) > alignof(Userdata) ? alignof(H) - alignof(Userdata) : 0);
+}
+
+template <typename H>
+inline H *_holder(Userdata *udata) {
+    const std::uintptr_t mask = alignof(H) - 1;
+    const auto address = reinterpret_cast<std::uintptr_t>(udata + 1);
+    return reinterpret_cast<H *>((address + mask) & ~mask);
+}
+
+template <typename H>
+inline void _release_holder(Userdata *udata) {
+    _holder<H>(udata)->~H();
+}
+
+inline void _release(Userdata *udata) {
+    if (udata->release == nullptr) return;
+    udata->release(udata);
+    udata->release = nullptr;
+    udata->object = nullptr;
+}
+
+// A block holding the instance itself
+template <typename T, typename... Args>
+inline T *_new_object(lua_State *l, Args&&... args) {
+    auto *udata = static_cast<Userdata *>(
+        lua_newuserdata(l, _block_size<T>()));
+    T *object = new(_holder<T>(udata)) T(std::forward<Args>(args)...);
+    udata->object = object;
+    udata->release = &_release_holder<T>;
+    return object;
+}
+
+// A block pointing to an instance owned elsewhere
+inline void _new_borrowed(lua_State *l, void *object) {
+    auto *udata = static_cast<Userdata *>(lua_newuserdata(l, sizeof(Userdata)));
+    udata->object = object;
+    udata->release = nullptr;
+}
+
+// A block holding a smart pointer to the instance
+template <typename P>
+inline void _new_owner(lua_State *l, P &&pointer) {
+    using H = typename std::decay<P>::type;
+    auto *udata = static_cast<Userdata *>(
+        lua_newuserdata(l, _block_size<H>()));
+    H *holder = new(_holder<H>(udata)) H(std::forward<P>(pointer));
+    udata->object = holder->get();
+    udata->release = &_release_holder<H>;
+}
+
+// The shared_ptr held by the block at index, or an empty one when it
+// holds the object some other way
+template <typename T>
+inline std::shared_ptr<T> _shared_owner(lua_State *l, int index) {
+    using H = std::shared_ptr<T>;
+#if LUA_VERSION_NUM >= 502
+    const std::size_t size = lua_rawlen(l, index);
+#else
+    const std::size_t size = lua_objlen(l, index);
+#endif
+    if (!_has_header(l, index) || size < _block_size<H>()) {
+        return H{};
+    }
+    auto *udata = static_cast<Userdata *>(lua_touserdata(l, index));
+    if (udata->release != &_release_holder<H>) return H{};
+    return *_holder<H>(udata);
+}
+
+// Keys the Share of a class in its metatable
+inline char *_share_key() {
+    static char key;
+    return &key;
+}
+
+// Gives the ownership held by a block holding a shared_ptr to an
+// instance of one class, whatever its type, or nothing for other blocks
+struct Share {
+    std::shared_ptr<void> (*share)(Userdata *);
+};
+
+template <typename T>
+inline std::shared_ptr<void> _share_holder(Userdata *udata) {
+    using H = std::shared_ptr<T>;
+    if (udata->release != &_release_holder<H>) return nullptr;
+    return *_holder<H>(udata);
+}
+
+// Stores the Share of T in the metatable on top of the stack
+template <typename T>
+inline void _mark_share(lua_State *l) {
+    static const Share share{&_share_holder<T>};
+    lua_pushlightuserdata(l, _share_key());
+    lua_pushlightuserdata(l, const_cast<Share *>(&share));
+    lua_rawset(l, -3);
+}
+
+// The ownership held by the block at index when it holds a shared_ptr
+// to an instance of a registered class
+inline std::shared_ptr<void> _shared_any(lua_State *l, int index) {
+    if (lua_type(l, index) != LUA_TUSERDATA || !lua_getmetatable(l, index)) {
+        return nullptr;
+    }
+    lua_pushlightuserdata(l, _share_key());
+    lua_rawget(l, -2);
+    auto *share = static_cast<const Share *>(lua_touserdata(l, -1));
+    lua_pop(l, 2);
+    if (share == nullptr) return nullptr;
+    return share->share(static_cast<Userdata *>(lua_touserdata(l, index)));
+}
+
+// __gc of owners pushed for a class that is not registered
+inline int _release_owner(lua_State *l) {
+    _release(static_cast<Userdata *>(lua_touserdata(l, 1)));
+    return 0;
+}
+
+inline void _set_owner_metatable(lua_State *l) {
+    if (luaL_newmetatable(l, "sel_owner")) {
+        lua_pushcfunction(l, &_release_owner);
+        lua_setfield(l, -2, "__gc");
+        _mark_header(l);
+    }
+    lua_setmetatable(l, -2);
+}
+}
+}
@@ -229,7 +229,7 @@ public:
     virtual void push_value(const detail::StateBlock &l) const override {
         Registry *registry = l.GetRegistry();
         if(registry)
-            registry->Register(this->_value);
+            registry->Register("(value)", this->_value);
     }
 };
 
@@ -241,12 +241,13 @@ public:
     virtual LuaValue* clone() const override { return new LuaFunctionValue(_value); }
     virtual sel::Value execute(const std::vector<sel::Value> &params) const override {
         const detail::StateBlock *state = _value.GetStateBlock().get();
+        const int top = lua_gettop(state->GetState());
         _value.Push();
         for(auto const &it:params)
             detail::_push(*state, it);
         lua_call(state->GetState(), (int)params.size(), 1);
         Value ret = detail::_pop(detail::_id<Value>{}, *state);
-        lua_settop(state->GetState(), 0);
+        lua_settop(state->GetState(), top);
         return ret;
     }
 
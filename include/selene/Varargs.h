@@ -0,0 +1,85 @@
+#pragma once
+
+#include "LuaRef.h"
+#include "primitives.h"
+
+namespace sel {
+/*
+ * A non-owning view of the arguments of a call from the position of
+ * the Varargs parameter onwards, which makes it the last parameter.
+ * Nothing is converted until Get is called, and pushing the view (or
+ * passing it to a sel::function or Selector call) forwards the values
+ * unchanged. Indices are 0-based. The view is only valid while the call
+ * it was received in is running. Calls through a sel::function or a
+ * selector made in that call return the stack to where they found it,
+ * so the view survives them; a selector made before the call returns
+ * it to its own height and must not be used there.
+ */
+class Varargs {
+private:
+    const detail::StateBlock *_state;
+    int _first;
+    int _size;
+
+public:
+    Varargs(const detail::StateBlock &state, int first)
+        : _state(&state), _first(first) {
+        const int top = lua_gettop(state.GetState());
+        _size = top >= first ? top - first + 1 : 0;
+    }
+
+    int Size() const {
+        return _size;
+    }
+
+    // The lua_type of argument i, LUA_TNONE when out of range
+    int Type(int i) const {
+        if (i < 0 || i >= _size) return LUA_TNONE;
+        return lua_type(_state->GetState(), _first + i);
+    }
+
+    template <typename T>
+    T Get(int i) const {
+        return detail::_get(detail::_id<T>{}, *_state, _first + i);
+    }
+
+    // Like Get, but raises a Lua error if argument i has the wrong type
+    template <typename T>
+    T Check(int i) const {
+        return detail::_check_get(detail::_id<T>{}, *_state, _first + i);
+    }
+
+    void Push(int i) const {
+        lua_pushvalue(_state->GetState(), _first + i);
+    }
+
+    // Pushes every argument in the view
+    void Push() const {
+        lua_State *l = _state->GetState();
+        luaL_checkstack(l, _size, "too many arguments");
+        for (int i = 0; i < _size; ++i) {
+            lua_pushvalue(l, _first + i);
+        }
+    }
+};
+
+namespace detail {
+
+inline Varargs _check_get(_id<Varargs>, const detail::StateBlock &l, const int index) {
+    return Varargs{l, index};
+}
+
+inline Varargs _get(_id<Varargs>, const detail::StateBlock &l, const int index) {
+    return Varargs{l, index};
+}
+
+inline void _push(const detail::StateBlock &, const Varargs &args) {
+    args.Push();
+}
+
+inline void _push(const detail::StateBlock &, MetatableRegistry &,
+                  const Varargs &args) {
+    args.Push();
+}
+}
+}
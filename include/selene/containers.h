@@ -0,0 +1,324 @@
+#pragma once
+
+#include <array>
+#include "ContainerRef.h"
+#include <cstddef>
+#include "exotics.h"
+#include <iterator>
+#include <map>
+#include <type_traits>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/*
+ * Converts standard containers to and from Lua tables directly, without
+ * going through sel::Value. Sequences and pairs become array tables,
+ * maps become tables keyed by their keys. Pushed tables are presized
+ * with lua_createtable and filled with raw sets; sequences are read
+ * back with lua_rawlen and lua_rawgeti. Reading a value that is not a
+ * table gives an empty container, and arguments must be tables.
+ */
+
+namespace sel {
+namespace detail {
+
+inline int _abs_index(lua_State *l, int index) {
+    return index < 0 && index > LUA_REGISTRYINDEX
+        ? lua_gettop(l) + index + 1 : index;
+}
+
+inline std::size_t _rawlen(lua_State *l, int index) {
+#if LUA_VERSION_NUM >= 502
+    return lua_rawlen(l, index);
+#else
+    return lua_objlen(l, index);
+#endif
+}
+
+// Declared up front so containers can nest
+
+template <typename T, typename A>
+inline std::vector<T, A> _get(_id<std::vector<T, A>>, const StateBlock &l, const int index);
+template <typename T, std::size_t N>
+inline std::array<T, N> _get(_id<std::array<T, N>>, const StateBlock &l, const int index);
+template <typename K, typename V, typename C, typename A>
+inline std::map<K, V, C, A> _get(_id<std::map<K, V, C, A>>, const StateBlock &l,
+                                 const int index);
+template <typename K, typename V, typename H, typename E, typename A>
+inline std::unordered_map<K, V, H, E, A> _get(
+    _id<std::unordered_map<K, V, H, E, A>>, const StateBlock &l, const int index);
+template <typename T1, typename T2>
+inline std::pair<T1, T2> _get(_id<std::pair<T1, T2>>, const StateBlock &l, const int index);
+
+template <typename T, typename A>
+inline void _push(const StateBlock &l, const std::vector<T, A> &v);
+template <typename T, std::size_t N>
+inline void _push(const StateBlock &l, const std::array<T, N> &a);
+template <typename K, typename V, typename C, typename A>
+inline void _push(const StateBlock &l, const std::map<K, V, C, A> &m);
+template <typename K, typename V, typename H, typename E, typename A>
+inline void _push(const StateBlock &l, const std::unordered_map<K, V, H, E, A> &m);
+template <typename T1, typename T2>
+inline void _push(const StateBlock &l, const std::pair<T1, T2> &p);
+
+template <typename T, typename A>
+inline void _push(const StateBlock &l, MetatableRegistry &meta, const std::vector<T, A> &v);
+template <typename T, std::size_t N>
+inline void _push(const StateBlock &l, MetatableRegistry &meta, const std::array<T, N> &a);
+template <typename K, typename V, typename C, typename A>
+inline void _push(const StateBlock &l, MetatableRegistry &meta,
+                  const std::map<K, V, C, A> &m);
+template <typename K, typename V, typename H, typename E, typename A>
+inline void _push(const StateBlock &l, MetatableRegistry &meta,
+                  const std::unordered_map<K, V, H, E, A> &m);
+template <typename T1, typename T2>
+inline void _push(const StateBlock &l, MetatableRegistry &meta, const std::pair<T1, T2> &p);
+
+// Reading
+
+template <typename T, typename Out>
+inline void _get_sequence(const StateBlock &l, int index, std::size_t size,
+                          Out out) {
+    lua_State *state = l.GetState();
+    for (std::size_t i = 0; i < size; ++i) {
+        lua_rawgeti(state, index, static_cast<int>(i + 1));
+        *out++ = _get(_id<T>{}, l, -1);
+        lua_pop(state, 1);
+    }
+}
+
+template <typename T, typename A>
+inline std::vector<T, A> _get(_id<std::vector<T, A>>, const StateBlock &l,
+                              const int index) {
+    std::vector<T, A> ret;
+    lua_State *state = l.GetState();
+    if (lua_type(state, index) != LUA_TTABLE) return ret;
+    const int table = _abs_index(state, index);
+    const std::size_t size = _rawlen(state, table);
+    ret.reserve(size);
+    _get_sequence<T>(l, table, size, std::back_inserter(ret));
+    return ret;
+}
+
+template <typename T, std::size_t N>
+inline std::array<T, N> _get(_id<std::array<T, N>>, const StateBlock &l,
+                             const int index) {
+    std::array<T, N> ret{};
+    lua_State *state = l.GetState();
+    if (lua_type(state, index) != LUA_TTABLE) return ret;
+    const int table = _abs_index(state, index);
+    const std::size_t size = _rawlen(state, table);
+    _get_sequence<T>(l, table, size < N ? size : N, ret.begin());
+    return ret;
+}
+
+// Maps have no array part to rely on, so they are walked with lua_next
+template <typename Map>
+inline Map _get_map(const StateBlock &l, const int index) {
+    using K = typename Map::key_type;
+    using V = typename Map::mapped_type;
+    Map ret;
+    lua_State *state = l.GetState();
+    if (lua_type(state, index) != LUA_TTABLE) return ret;
+    const int table = _abs_index(state, index);
+    lua_pushnil(state);
+    while (lua_next(state, table)) {
+        // Converting a number key to a string in place would confuse
+        // lua_next, so the key is read from a copy
+        lua_pushvalue(state, -2);
+        ret.emplace(_get(_id<K>{}, l, -1), _get(_id<V>{}, l, -2));
+        lua_pop(state, 2);
+    }
+    return ret;
+}
+
+template <typename K, typename V, typename C, typename A>
+inline std::map<K, V, C, A> _get(_id<std::map<K, V, C, A>>, const StateBlock &l,
+                                 const int index) {
+    return _get_map<std::map<K, V, C, A>>(l, index);
+}
+
+template <typename K, typename V, typename H, typename E, typename A>
+inline std::unordered_map<K, V, H, E, A> _get(
+    _id<std::unordered_map<K, V, H, E, A>>, const StateBlock &l, const int index) {
+    return _get_map<std::unordered_map<K, V, H, E, A>>(l, index);
+}
+
+template <typename T1, typename T2>
+inline std::pair<T1, T2> _get(_id<std::pair<T1, T2>>, const StateBlock &l,
+                              const int index) {
+    lua_State *state = l.GetState();
+    if (lua_type(state, index) != LUA_TTABLE) return std::pair<T1, T2>{};
+    const int table = _abs_index(state, index);
+    lua_rawgeti(state, table, 1);
+    lua_rawgeti(state, table, 2);
+    std::pair<T1, T2> ret{_get(_id<T1>{}, l, -2), _get(_id<T2>{}, l, -1)};
+    lua_pop(state, 2);
+    return ret;
+}
+
+template <typename T, typename A>
+inline std::vector<T, A> _check_get(_id<std::vector<T, A>> id, const StateBlock &l,
+                                    const int index) {
+    luaL_checktype(l.GetState(), index, LUA_TTABLE);
+    return _get(id, l, index);
+}
+
+template <typename T, std::size_t N>
+inline std::array<T, N> _check_get(_id<std::array<T, N>> id, const StateBlock &l,
+                                   const int index) {
+    luaL_checktype(l.GetState(), index, LUA_TTABLE);
+    return _get(id, l, index);
+}
+
+template <typename K, typename V, typename C, typename A>
+inline std::map<K, V, C, A> _check_get(_id<std::map<K, V, C, A>> id,
+                                       const StateBlock &l, const int index) {
+    luaL_checktype(l.GetState(), index, LUA_TTABLE);
+    return _get(id, l, index);
+}
+
+template <typename K, typename V, typename H, typename E, typename A>
+inline std::unordered_map<K, V, H, E, A> _check_get(
+    _id<std::unordered_map<K, V, H, E, A>> id, const StateBlock &l, const int index) {
+    luaL_checktype(l.GetState(), index, LUA_TTABLE);
+    return _get(id, l, index);
+}
+
+template <typename T1, typename T2>
+inline std::pair<T1, T2> _check_get(_id<std::pair<T1, T2>> id, const StateBlock &l,
+                                    const int index) {
+    luaL_checktype(l.GetState(), index, LUA_TTABLE);
+    return _get(id, l, index);
+}
+
+// Pushing. Elements go through the same overloads as single values, so
+// with a MetatableRegistry class instances keep their metatables.
+// Instances of registered classes are copied into userdata owned by
+// Lua, since the container is often a temporary returned by value.
+
+template <typename T>
+inline void _push_element(const StateBlock &l, const T &value) {
+    _push(l, value);
+}
+
+template <typename T>
+inline void _push_element(const StateBlock &l, MetatableRegistry &meta,
+                          const T &value, std::false_type) {
+    _push(l, meta, value);
+}
+
+template <typename T>
+inline void _push_element(const StateBlock &l, MetatableRegistry &meta,
+                          const T &value, std::true_type) {
+    const Metatable *metatable = meta.Find(typeid(T));
+    if (metatable == nullptr) {
+        _push(l, meta, value);
+        return;
+    }
+    lua_State *state = l.GetState();
+    T *object = _new_object<T>(state, value);
+    _set_metatable(state, *metatable);
+    _cache_identity(l, object);
+}
+
+template <typename T>
+inline void _push_element(const StateBlock &l, MetatableRegistry &meta,
+                          const T &value) {
+    _push_element(l, meta, value, std::integral_constant<
+                      bool, std::is_class<T>::value &&
+                            std::is_copy_constructible<T>::value>{});
+}
+
+template <typename It, typename... Meta>
+inline void _push_sequence(const StateBlock &l, It first, std::size_t size,
+                           Meta&... meta) {
+    lua_State *state = l.GetState();
+    lua_createtable(state, static_cast<int>(size), 0);
+    for (std::size_t i = 0; i < size; ++i, ++first) {
+        const auto &value = *first;
+        _push_element(l, meta..., value);
+        lua_rawseti(state, -2, static_cast<int>(i + 1));
+    }
+}
+
+template <typename Map, typename... Meta>
+inline void _push_map(const StateBlock &l, const Map &m, Meta&... meta) {
+    lua_State *state = l.GetState();
+    lua_createtable(state, 0, static_cast<int>(m.size()));
+    for (const auto &entry : m) {
+        _push_element(l, meta..., entry.first);
+        _push_element(l, meta..., entry.second);
+        lua_rawset(state, -3);
+    }
+}
+
+template <typename T1, typename T2, typename... Meta>
+inline void _push_pair(const StateBlock &l, const std::pair<T1, T2> &p,
+                       Meta&... meta) {
+    lua_State *state = l.GetState();
+    lua_createtable(state, 2, 0);
+    _push_element(l, meta..., p.first);
+    lua_rawseti(state, -2, 1);
+    _push_element(l, meta..., p.second);
+    lua_rawseti(state, -2, 2);
+}
+
+template <typename T, typename A>
+inline void _push(const StateBlock &l, const std::vector<T, A> &v) {
+    _push_sequence(l, v.begin(), v.size());
+}
+
+template <typename T, std::size_t N>
+inline void _push(const StateBlock &l, const std::array<T, N> &a) {
+    _push_sequence(l, a.begin(), N);
+}
+
+template <typename K, typename V, typename C, typename A>
+inline void _push(const StateBlock &l, const std::map<K, V, C, A> &m) {
+    _push_map(l, m);
+}
+
+template <typename K, typename V, typename H, typename E, typename A>
+inline void _push(const StateBlock &l, const std::unordered_map<K, V, H, E, A> &m) {
+    _push_map(l, m);
+}
+
+template <typename T1, typename T2>
+inline void _push(const StateBlock &l, const std::pair<T1, T2> &p) {
+    _push_pair(l, p);
+}
+
+template <typename T, typename A>
+inline void _push(const StateBlock &l, MetatableRegistry &meta,
+                  const std::vector<T, A> &v) {
+    _push_sequence(l, v.begin(), v.size(), meta);
+}
+
+template <typename T, std::size_t N>
+inline void _push(const StateBlock &l, MetatableRegistry &meta,
+                  const std::array<T, N> &a) {
+    _push_sequence(l, a.begin(), N, meta);
+}
+
+template <typename K, typename V, typename C, typename A>
+inline void _push(const StateBlock &l, MetatableRegistry &meta,
+                  const std::map<K, V, C, A> &m) {
+    _push_map(l, m, meta);
+}
+
+template <typename K, typename V, typename H, typename E, typename A>
+inline void _push(const StateBlock &l, MetatableRegistry &meta,
+                  const std::unordered_map<K, V, H, E, A> &m) {
+    _push_map(l, m, meta);
+}
+
+template <typename T1, typename T2>
+inline void _push(const StateBlock &l, MetatableRegistry &meta,
+                  const std::pair<T1, T2> &p) {
+    _push_pair(l, p, meta);
+}
+}
+}
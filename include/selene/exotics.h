@@ -1,6 +1,8 @@
 #pragma once
 
 #include "function.h"
+#include "LuaString.h"
+#include "Varargs.h"
 
 /*
  * Extends manipulation of primitives on the stack with more exotic
@@ -28,5 +30,40 @@ inline void _push(const detail::StateBlock &l, sel::function<R(Args...)> fun) {
     fun.Push();
 }
 
+template <typename R, typename... Args>
+inline void _push(const detail::StateBlock &, MetatableRegistry &,
+                  sel::function<R(Args...)> fun) {
+    fun.Push();
+}
+
+inline LuaString _check_get(_id<LuaString>, const detail::StateBlock &l,
+                            const int index) {
+    size_t size;
+    const char *buff = luaL_checklstring(l.GetState(), index, &size);
+    return LuaString{l, index, buff, size};
+}
+
+inline LuaString _get(_id<LuaString>, const detail::StateBlock &l,
+                      const int index) {
+    size_t size = 0;
+    const char *buff = lua_tolstring(l.GetState(), index, &size);
+    if (buff == nullptr) {
+        lua_pushliteral(l.GetState(), "");
+        LuaString empty{l, -1, lua_tostring(l.GetState(), -1), 0};
+        lua_pop(l.GetState(), 1);
+        return empty;
+    }
+    return LuaString{l, index, buff, size};
+}
+
+inline void _push(const detail::StateBlock &, const LuaString &s) {
+    s.Push();
+}
+
+inline void _push(const detail::StateBlock &, MetatableRegistry &,
+                  const LuaString &s) {
+    s.Push();
+}
+
 }
 }
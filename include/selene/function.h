@@ -1,12 +1,206 @@
 #pragma once
 
+#include <cstddef>
 #include <functional>
 #include "LuaRef.h"
 #include <memory>
 #include "primitives.h"
+#include <tuple>
 #include "util.h"
+#include <vector>
 
 namespace sel {
+namespace detail {
+
+// Calls the function once for each of count items. The message handler
+// and the function stay on the stack for the whole batch; each call
+// gets a copy of the function, the arguments pushed by push_args(i),
+// and leaves nresults values for read(i) to pop. Failed items read nils
+// and are returned with their errors.
+template <typename PushArgs, typename Read>
+inline std::vector<BatchError> _batch(const LuaRef &ref, std::size_t count,
+                                      int nresults, PushArgs push_args,
+                                      Read read) {
+    const StateBlock &state = *ref.GetStateBlock();
+    lua_State *l = state.GetState();
+    const int base = lua_gettop(l);
+    int handler = 0;
+    if (state.TracebacksEnabled()) {
+        state.PushErrorHandler();
+        handler = lua_gettop(l);
+    }
+    ref.Push();
+    const int fun = lua_gettop(l);
+    std::vector<BatchError> errors;
+    for (std::size_t i = 0; i < count; ++i) {
+        lua_pushvalue(l, fun);
+        push_args(i);
+        const int status = lua_pcall(l, lua_gettop(l) - fun - 1, nresults,
+                                     handler);
+        if (status != 0) {
+            if (handler == 0 || status != LUA_ERRRUN) {
+                state.GetLastError().traceback.clear();
+            }
+            _record_error(state, status, "call");
+            errors.push_back(BatchError{i, state.GetLastError()});
+            for (int j = 0; j < nresults; ++j) lua_pushnil(l);
+        }
+        read(i);
+    }
+    lua_settop(l, base);
+    return errors;
+}
+
+// How many results a call returning R leaves and how to pop them
+template <typename R>
+struct _results {
+    static constexpr int count = 1;
+    static R Pop(const StateBlock &state) {
+        return _pop(_id<R>{}, state);
+    }
+};
+
+template <>
+struct _results<void> {
+    static constexpr int count = 0;
+    static void Pop(const StateBlock &) {}
+};
+
+template <typename... R>
+struct _results<std::tuple<R...>> {
+    static constexpr int count = sizeof...(R);
+    static std::tuple<R...> Pop(const StateBlock &state) {
+        return std::tuple<R...>(_pop_n<R...>(state));
+    }
+};
+}
+
+/*
+ * A call to a Lua function set up once for many invocations, returned
+ * by sel::function::Prepare. The message handler (when tracebacks are
+ * enabled) and the function are pushed once and kept on the stack,
+ * stack space is reserved up front, and each call only pops its own
+ * results, leaving the rest of the stack as it was.
+ *
+ * The slots are only reused when they are on top of the stack and
+ * still hold this function, which rules out the stack of a binding
+ * called in between. If something else resets the stack below them,
+ * such as a selector access, the next call pushes them again. If values
+ * were pushed above them, the call pushes the function for itself and
+ * drops it afterwards. The resident slots are popped on destruction
+ * if they are still on top.
+ */
+template <class>
+class PreparedCall;
+
+template <typename R, typename... Args>
+class PreparedCall<R(Args...)> {
+private:
+    LuaRef _ref;
+    lua_State *_l;
+    int _base;
+    int _handler;
+    int _fun;
+
+    struct _restore_top {
+        lua_State *l;
+        int top;
+        ~_restore_top() {
+            lua_settop(l, top);
+        }
+    };
+
+    void _reserve() {
+        luaL_checkstack(_l, 3 + static_cast<int>(sizeof...(Args)) +
+                        detail::_results<R>::count, "prepared call");
+    }
+
+    // Pushes the message handler if tracebacks are enabled, returning
+    // its index or 0, then the function
+    int _push_slots() {
+        const detail::StateBlock &state = *_ref.GetStateBlock();
+        int handler = 0;
+        if (state.TracebacksEnabled()) {
+            state.PushErrorHandler();
+            handler = lua_gettop(_l);
+        }
+        _ref.Push();
+        return handler;
+    }
+
+    bool _resident() {
+        if (lua_gettop(_l) != _fun) return false;
+        _ref.Push();
+        bool ours = lua_rawequal(_l, -1, _fun) != 0;
+        lua_pop(_l, 1);
+        if (ours && _handler != 0) {
+            _ref.GetStateBlock()->PushErrorHandler();
+            ours = lua_rawequal(_l, -1, _handler) != 0;
+            lua_pop(_l, 1);
+        }
+        return ours;
+    }
+
+    // Calls the function at fun, leaving the stack as it was up to fun
+    R _call(int handler, int fun, Args... args) {
+        const detail::StateBlock &state = *_ref.GetStateBlock();
+        lua_pushvalue(_l, fun);
+        detail::_push_n(state, args...);
+        const int status = lua_pcall(_l, lua_gettop(_l) - fun - 1,
+                                     detail::_results<R>::count, handler);
+        if (status != 0) {
+            if (handler == 0 || status != LUA_ERRRUN) {
+                state.GetLastError().traceback.clear();
+            }
+            detail::_record_error(state, status, "call");
+            lua_settop(_l, fun + detail::_results<R>::count);
+        }
+        return detail::_results<R>::Pop(state);
+    }
+
+    void _setup() {
+        _base = lua_gettop(_l);
+        // The resident slots, a copy of the function, the arguments
+        // and the results
+        _reserve();
+        _handler = _push_slots();
+        _fun = lua_gettop(_l);
+    }
+
+public:
+    explicit PreparedCall(const LuaRef &ref)
+        : _ref(ref), _l(ref.GetStateBlock()->GetState()) {
+        _setup();
+    }
+
+    PreparedCall(PreparedCall &&other)
+        : _ref(other._ref), _l(other._l), _base(other._base),
+          _handler(other._handler), _fun(other._fun) {
+        other._l = nullptr;
+    }
+
+    PreparedCall(const PreparedCall &) = delete;
+    PreparedCall &operator=(const PreparedCall &) = delete;
+
+    ~PreparedCall() {
+        if (_l != nullptr && _resident()) {
+            lua_settop(_l, _base);
+        }
+    }
+
+    R operator()(Args... args) {
+        if (_resident()) return _call(_handler, _fun, args...);
+        if (lua_gettop(_l) < _fun) {
+            _setup();
+            return _call(_handler, _fun, args...);
+        }
+        _restore_top restore{_l, lua_gettop(_l)};
+        _reserve();
+        const int handler = _push_slots();
+        return _call(handler, lua_gettop(_l), args...);
+    }
+};
+
 /*
  * Similar to an std::function but refers to a lua function
  */
@@ -22,17 +216,46 @@ public:
     function(const LuaRef &ref) : _ref(ref) {}
 
     R operator()(Args... args) {
-        int handler_index = SetErrorHandler(_ref.GetStateBlock()->GetState());
+        const detail::StateBlock &state = *_ref.GetStateBlock();
+        // Restored afterwards, so a call made from a binding keeps the
+        // binding's arguments
+        const int top = lua_gettop(state.GetState());
         _ref.Push();
-        detail::_push_n(_ref.GetStateBlock(), args...);
-        constexpr int num_args = sizeof...(Args);
-        lua_pcall(_ref.GetStateBlock()->GetState(), num_args, 1, handler_index);
-        lua_remove(_ref.GetStateBlock()->GetState(), handler_index);
-        R ret = detail::_pop(detail::_id<R>{}, _ref.GetStateBlock());
-        lua_settop(_ref.GetStateBlock()->GetState(), 0);
+        const int base = top + 1;
+        detail::_push_n(state, args...);
+        // Varargs push any number of values
+        const int num_args = lua_gettop(state.GetState()) - base;
+        detail::_pcall(state, num_args, 1);
+        R ret = detail::_pop(detail::_id<R>{}, state);
+        lua_settop(state.GetState(), top);
         return ret;
     }
 
+    // Calls the function with each of the count argument tuples and
+    // writes the results to out. Items that fail get the value read
+    // from nil and are listed in the returned errors; the rest of the
+    // batch still runs.
+    std::vector<BatchError> Batch(const std::tuple<Args...> *args,
+                                  std::size_t count, R *out) {
+        const detail::StateBlock &state = *_ref.GetStateBlock();
+        return detail::_batch(
+            _ref, count, 1,
+            [&](std::size_t i) { detail::_push(state, args[i]); },
+            [&](std::size_t i) { out[i] = detail::_pop(detail::_id<R>{}, state); });
+    }
+
+    std::vector<BatchError> Batch(const std::vector<std::tuple<Args...>> &args,
+                                  std::vector<R> &out) {
+        out.resize(args.size());
+        return Batch(args.data(), args.size(), out.data());
+    }
+
+    // A call object that keeps this function on the stack for repeated
+    // calls
+    PreparedCall<R(Args...)> Prepare() const {
+        return PreparedCall<R(Args...)>(_ref);
+    }
+
     void Push() {
         _ref.Push();
     }
@@ -47,13 +270,37 @@ public:
     function(const LuaRef &ref) : _ref(ref) {}
 
     void operator()(Args... args) {
-        int handler_index = SetErrorHandler(_ref.GetStateBlock()->GetState());
+        const detail::StateBlock &state = *_ref.GetStateBlock();
+        const int top = lua_gettop(state.GetState());
         _ref.Push();
-        detail::_push_n(_ref.GetStateBlock(), args...);
-        constexpr int num_args = sizeof...(Args);
-        lua_pcall(_ref.GetStateBlock()->GetState(), num_args, 1, handler_index);
-        lua_remove(_ref.GetStateBlock()->GetState(), handler_index);
-        lua_settop(_ref.GetStateBlock()->GetState(), 0);
+        const int base = top + 1;
+        detail::_push_n(state, args...);
+        // Varargs push any number of values
+        const int num_args = lua_gettop(state.GetState()) - base;
+        detail::_pcall(state, num_args, 0);
+        lua_settop(state.GetState(), top);
+    }
+
+    // Calls the function with each of the count argument tuples. Items
+    // that fail are listed in the returned errors; the rest of the
+    // batch still runs.
+    std::vector<BatchError> Batch(const std::tuple<Args...> *args,
+                                  std::size_t count) {
+        const detail::StateBlock &state = *_ref.GetStateBlock();
+        return detail::_batch(
+            _ref, count, 0,
+            [&](std::size_t i) { detail::_push(state, args[i]); },
+            [](std::size_t) {});
+    }
+
+    std::vector<BatchError> Batch(const std::vector<std::tuple<Args...>> &args) {
+        return Batch(args.data(), args.size());
+    }
+
+    // A call object that keeps this function on the stack for repeated
+    // calls
+    PreparedCall<void(Args...)> Prepare() const {
+        return PreparedCall<void(Args...)>(_ref);
     }
 
     void Push() {
@@ -71,14 +318,43 @@ public:
     function(const LuaRef &ref) : _ref(ref) {}
 
     std::tuple<R...> operator()(Args... args) {
-        int handler_index = SetErrorHandler(_ref.GetStateBlock()->GetState());
+        const detail::StateBlock &state = *_ref.GetStateBlock();
+        const int top = lua_gettop(state.GetState());
         _ref.Push();
-        detail::_push_n(_ref.GetStateBlock(), args...);
-        constexpr int num_args = sizeof...(Args);
+        const int base = top + 1;
+        detail::_push_n(state, args...);
+        // Varargs push any number of values
+        const int num_args = lua_gettop(state.GetState()) - base;
         constexpr int num_ret = sizeof...(R);
-        lua_pcall(_ref.GetStateBlock()->GetState(), num_args, num_ret, handler_index);
-        lua_remove(_ref.GetStateBlock()->GetState(), handler_index);
-        return detail::_pop_n_reset<R...>(_ref.GetStateBlock());
+        detail::_pcall(state, num_args, num_ret);
+        std::tuple<R...> ret(detail::_pop_n<R...>(state));
+        lua_settop(state.GetState(), top);
+        return ret;
+    }
+
+    // Like the single result Batch, with each item's results read into
+    // a tuple
+    std::vector<BatchError> Batch(const std::tuple<Args...> *args,
+                                  std::size_t count, std::tuple<R...> *out) {
+        const detail::StateBlock &state = *_ref.GetStateBlock();
+        return detail::_batch(
+            _ref, count, sizeof...(R),
+            [&](std::size_t i) { detail::_push(state, args[i]); },
+            [&](std::size_t i) {
+                out[i] = std::tuple<R...>(detail::_pop_n<R...>(state));
+            });
+    }
+
+    std::vector<BatchError> Batch(const std::vector<std::tuple<Args...>> &args,
+                                  std::vector<std::tuple<R...>> &out) {
+        out.resize(args.size());
+        return Batch(args.data(), args.size(), out.data());
+    }
+
+    // A call object that keeps this function on the stack for repeated
+    // calls
+    PreparedCall<std::tuple<R...>(Args...)> Prepare() const {
+        return PreparedCall<std::tuple<R...>(Args...)>(_ref);
     }
 
     void Push() {
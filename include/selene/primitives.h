@@ -1,6 +1,9 @@
 #pragma once
 
 #include <string>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
 #include <map>
 #include <vector>
 #include "traits.h"
@@ -207,12 +210,69 @@ template <>
 struct is_primitive<std::string> {
     static constexpr bool value = true;
 };
+#if __cplusplus >= 201703L
+template <>
+struct is_primitive<std::string_view> {
+    static constexpr bool value = true;
+};
+#endif
+
+// The metatables of the classes registered in the state, defined after
+// the Registry
+inline MetatableRegistry &_metatables(const detail::StateBlock &state);
+
+// The T behind the value at index, adjusted from a derived class, or
+// null if it is not a T. Only types that are not registered fall back
+// to whatever the userdata holds.
+template <typename T>
+inline T *_to_instance(const detail::StateBlock &l, const int index) {
+    const Metatable *metatable = _metatables(l).Find(typeid(T));
+    if (metatable != nullptr) {
+        return static_cast<T *>(_test_udata(l.GetState(), index, *metatable));
+    }
+    return static_cast<T *>(_to_object(l.GetState(), index));
+}
+
+// Like _to_instance, raising an argument error instead of returning null
+template <typename T>
+inline T *_check_instance(const detail::StateBlock &l, const int index) {
+    T *object = _to_instance<T>(l, index);
+    if (object == nullptr) {
+        lua_State *state = l.GetState();
+        const Metatable *metatable = _metatables(l).Find(typeid(T));
+        luaL_argerror(state, index, lua_pushfstring(
+                          state, "%s expected, got %s",
+                          metatable != nullptr ? metatable->name.c_str() : "object",
+                          luaL_typename(state, index)));
+    }
+    return object;
+}
 
 /* getters */
 template <typename T>
 inline T* _get(_id<T*>, const detail::StateBlock &l, const int index) {
-    auto t = lua_topointer(l.GetState(), index);
-    return (T*)(t);
+    return _to_instance<T>(l, index);
+}
+
+// Shares ownership with the userdata when it holds a shared_ptr<T>, or
+// a shared_ptr to a class derived from a registered T, aliasing its
+// control block with the upcast instance
+template <typename T>
+inline std::shared_ptr<T> _to_shared(const detail::StateBlock &l, const int index) {
+    lua_State *state = l.GetState();
+    std::shared_ptr<T> exact = _shared_owner<T>(state, index);
+    if (exact || _metatables(l).Find(typeid(T)) == nullptr) return exact;
+    T *object = _to_instance<T>(l, index);
+    if (object == nullptr) return exact;
+    std::shared_ptr<void> owner = _shared_any(state, index);
+    if (!owner) return exact;
+    return std::shared_ptr<T>(owner, object);
+}
+
+template <typename T>
+inline std::shared_ptr<T> _get(_id<std::shared_ptr<T>>,
+                               const detail::StateBlock &l, const int index) {
+    return _to_shared<T>(l, index);
 }
 
 inline bool _get(_id<bool>, const detail::StateBlock &l, const int index) {
@@ -278,19 +338,47 @@ inline std::string _get(_id<std::string>, const detail::StateBlock &l, const int
     const char *buff = lua_tolstring(l.GetState(), index, &size);
     return std::string{buff, size};
 }
+
+// Points into the Lua string, which is only guaranteed to live while
+// the value stays on the stack
+inline const char *_get(_id<const char *>, const detail::StateBlock &l, const int index) {
+    return lua_tostring(l.GetState(), index);
+}
+
+#if __cplusplus >= 201703L
+inline std::string_view _get(_id<std::string_view>, const detail::StateBlock &l,
+                             const int index) {
+    size_t size = 0;
+    const char *buff = lua_tolstring(l.GetState(), index, &size);
+    return buff ? std::string_view{buff, size} : std::string_view{};
+}
+#endif
     
 inline Value _get(_id<Value>, const detail::StateBlock &l, const int index);
 
 template <typename T>
 inline T* _check_get(_id<T*>, const detail::StateBlock &l, const int index) {
-    return (T *)lua_topointer(l.GetState(), index);
+    if (lua_isnoneornil(l.GetState(), index)) return nullptr;
+    return _check_instance<T>(l, index);
 };
 
+template <typename T>
+inline std::shared_ptr<T> _check_get(_id<std::shared_ptr<T>>,
+                                     const detail::StateBlock &l,
+                                     const int index) {
+    lua_State *state = l.GetState();
+    std::shared_ptr<T> ret = _to_shared<T>(l, index);
+    if (!ret && !lua_isnil(state, index)) {
+        luaL_argerror(state, index, "shared object expected");
+    }
+    return ret;
+}
+
 template <typename T>
 inline T& _check_get(_id<T&>, const detail::StateBlock &l, const int index) {
     static_assert(!is_primitive<T>::value,
                   "Reference types must not be primitives.");
-    return *(T *)lua_topointer(l.GetState(), index);
+    return *_check_instance<T>(l, index);
 };
 
 template <typename T>
@@ -361,6 +449,22 @@ inline std::string _check_get(_id<std::string>, const detail::StateBlock &l, con
     const char *buff = luaL_checklstring(l.GetState(), index, &size);
     return std::string{buff, size};
 }
+
+// Arguments stay on the stack for the whole call, so these can point
+// straight into the Lua string
+inline const char *_check_get(_id<const char *>, const detail::StateBlock &l,
+                              const int index) {
+    return luaL_checkstring(l.GetState(), index);
+}
+
+#if __cplusplus >= 201703L
+inline std::string_view _check_get(_id<std::string_view>, const detail::StateBlock &l,
+                                   const int index) {
+    size_t size;
+    const char *buff = luaL_checklstring(l.GetState(), index, &size);
+    return std::string_view{buff, size};
+}
+#endif
     
 inline Value _check_get(_id<Value>, const detail::StateBlock &l, const int index);
 
@@ -371,10 +475,12 @@ template <std::size_t S, typename... Ts> // First template argument denotes
 struct _pop_n_impl {
     using type =  std::tuple<Ts...>;
 
+    // Relative to the top, so values below the S popped are left alone
     template <std::size_t... N>
     static type worker(const detail::StateBlock &l,
                        _indices<N...>) {
-        return std::make_tuple(_get(_id<Ts>{}, l, N + 1)...);
+        return std::make_tuple(
+            _get(_id<Ts>{}, l, static_cast<int>(N) - static_cast<int>(S))...);
     }
 
     static type apply(const detail::StateBlock &l) {
@@ -407,49 +513,6 @@ typename _pop_n_impl<sizeof...(T), T...>::type _pop_n(const detail::StateBlock &
     return _pop_n_impl<sizeof...(T), T...>::apply(l);
 }
 
-template <std::size_t S, typename... Ts>
-struct _pop_n_reset_impl {
-    using type =  std::tuple<Ts...>;
-
-    template <std::size_t... N>
-    static type worker(const detail::StateBlock &l,
-                       _indices<N...>) {
-        return std::make_tuple(_get(_id<Ts>{}, l, N + 1)...);
-    }
-
-    static type apply(const detail::StateBlock &l) {
-        auto ret = worker(l, typename _indices_builder<S>::type());
-        lua_settop(l.GetState(), 0);
-        return ret;
-    }
-};
-
-// Popping nothing returns void
-template <typename... Ts>
-struct _pop_n_reset_impl<0, Ts...> {
-    using type = void;
-    static type apply(const detail::StateBlock &l) {
-        lua_settop(l.GetState(), 0);
-    }
-};
-
-// Popping one element returns an unboxed value
-template <typename T>
-struct _pop_n_reset_impl<1, T> {
-    using type = T;
-    static type apply(const detail::StateBlock &l) {
-        T ret = _get(_id<T>{}, l, -1);
-        lua_settop(l.GetState(), 0);
-        return ret;
-    }
-};
-
-template <typename... T>
-typename _pop_n_reset_impl<sizeof...(T), T...>::type
-_pop_n_reset(const detail::StateBlock &l) {
-    return _pop_n_reset_impl<sizeof...(T), T...>::apply(l);
-}
-
 template <typename T>
 T _pop(_id<T> t, const detail::StateBlock &l) {
     T ret =  _get(t, l, -1);
@@ -461,27 +524,97 @@ T _pop(_id<T> t, const detail::StateBlock &l) {
 
 inline void _push(const detail::StateBlock &l) {}
 
+// Records the userdata on top of the stack as the one of the object
+inline void _cache_identity(const detail::StateBlock &l, void *object) {
+    lua_State *state = l.GetState();
+    if (l.IdentityCache() == LUA_NOREF) return;
+    lua_rawgeti(state, LUA_REGISTRYINDEX, l.IdentityCache());
+    lua_pushlightuserdata(state, object);
+    lua_pushvalue(state, -3);
+    lua_rawset(state, -3);
+    lua_pop(state, 1);
+}
+
+// Pushes the cached userdata of the object if it has the metatable
+inline bool _push_cached(const detail::StateBlock &l,
+                         const detail::Metatable &metatable, void *object) {
+    lua_State *state = l.GetState();
+    if (l.IdentityCache() == LUA_NOREF) return false;
+    lua_rawgeti(state, LUA_REGISTRYINDEX, l.IdentityCache());
+    lua_pushlightuserdata(state, object);
+    lua_rawget(state, -2);
+    lua_remove(state, -2);
+    if (_has_metatable(state, -1, metatable)) return true;
+    lua_pop(state, 1);
+    return false;
+}
+
+// Instances of registered classes are boxed in a userdata with the
+// class metatable, which does not own them. Other pointers are pushed
+// as light userdata, as all of those share a single metatable.
+template <typename T>
+inline void _push_borrowed(const detail::StateBlock &l, MetatableRegistry &m,
+                           T *t) {
+    lua_State *state = l.GetState();
+    void *object = (void *)t;
+    if (const detail::Metatable* metatable = m.Find(typeid(T))) {
+        if (_push_cached(l, *metatable, object)) return;
+        _new_borrowed(state, object);
+        _set_metatable(state, *metatable);
+        _cache_identity(l, object);
+    } else {
+        lua_pushlightuserdata(state, object);
+    }
+}
+
 template <typename T>
 inline void _push(const detail::StateBlock &l, MetatableRegistry &m, T* t) {
 	if(t == nullptr) {
 		lua_pushnil(l.GetState());
 	}
 	else {
-		lua_pushlightuserdata(l, t);
-		if (const std::string* metatable = m.Find(typeid(T))) {
-			luaL_setmetatable(l.GetState(), metatable->c_str());
-		}
+		_push_borrowed(l, m, t);
 	}
 }
 
 template <typename T>
 inline void _push(const detail::StateBlock &l, MetatableRegistry &m, T& t) {
-    lua_pushlightuserdata(l.GetState(), &t);
-    if (const std::string* metatable = m.Find(typeid(T))) {
-        luaL_setmetatable(l.GetState(), metatable->c_str());
+    _push_borrowed(l, m, &t);
+}
+
+// Moves a smart pointer into a userdata released by __gc. Instances of
+// registered classes get the class metatable.
+template <typename P>
+inline void _push_owner(const detail::StateBlock &l, MetatableRegistry &m,
+                        P &&pointer) {
+    using T = typename std::decay<P>::type::element_type;
+    lua_State *state = l.GetState();
+    if (!pointer) {
+        lua_pushnil(state);
+        return;
+    }
+    void *object = (void *)pointer.get();
+    _new_owner(state, std::forward<P>(pointer));
+    if (const detail::Metatable* metatable = m.Find(typeid(T))) {
+        _set_metatable(state, *metatable);
+        _cache_identity(l, object);
+    } else {
+        _set_owner_metatable(state);
     }
 }
 
+template <typename T>
+inline void _push(const detail::StateBlock &l, MetatableRegistry &m,
+                  std::shared_ptr<T> t) {
+    _push_owner(l, m, std::move(t));
+}
+
+template <typename T, typename D>
+inline void _push(const detail::StateBlock &l, MetatableRegistry &m,
+                  std::unique_ptr<T, D> t) {
+    _push_owner(l, m, std::move(t));
+}
+
 inline void _push(const detail::StateBlock &l, MetatableRegistry &, bool b) {
     lua_pushboolean(l.GetState(), b);
 }
@@ -547,6 +680,12 @@ inline void _push(const detail::StateBlock &l, MetatableRegistry &, const std::s
 inline void _push(const detail::StateBlock &l, MetatableRegistry &, const char *s) {
     lua_pushstring(l.GetState(), s);
 }
+
+#if __cplusplus >= 201703L
+inline void _push(const detail::StateBlock &l, MetatableRegistry &, std::string_view s) {
+    lua_pushlstring(l.GetState(), s.data(), s.size());
+}
+#endif
     
 inline void _push(const detail::StateBlock &l, MetatableRegistry &, const Value& value);
 
@@ -626,6 +765,12 @@ inline void _push(const detail::StateBlock &l, const std::string &s) {
 inline void _push(const detail::StateBlock &l, const char *s) {
     lua_pushstring(l.GetState(), s);
 }
+
+#if __cplusplus >= 201703L
+inline void _push(const detail::StateBlock &l, std::string_view s) {
+    lua_pushlstring(l.GetState(), s.data(), s.size());
+}
+#endif
     
 inline void _push(const detail::StateBlock &l, const Value& value);
 
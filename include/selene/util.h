@@ -1,6 +1,8 @@
 #pragma once
 
 #include <iostream>
+#include "LuaRef.h"
+#include <string>
 
 extern "C" {
 #include <lua.h>
@@ -34,7 +36,7 @@ inline std::ostream &operator<<(std::ostream &os, lua_State *l) {
 }
 
 inline void _print() {
-    std::cout << std::endl;
+    std::cout << '\n';
 }
 
 template <typename T, typename... Ts>
@@ -51,32 +53,66 @@ inline bool check(lua_State *L, int code) {
 #endif
         return true;
     } else {
-        std::cout << lua_tostring(L, -1) << std::endl;
+        std::cout << lua_tostring(L, -1) << '\n';
         return false;
     }
 }
 
-inline int ErrorHandler(lua_State *L) {
-    // call debug.traceback
-    lua_getglobal(L, "debug");
-    lua_getfield(L, -1, "traceback");
-    lua_pushvalue(L, 1);
-    lua_pushinteger(L, 2);
-    lua_call(L, 2, 1);
+namespace detail {
+// Replaces the environment of the function at fn_index with the table
+// on top of the stack, popping the table.
+inline void _set_env(lua_State *l, int fn_index) {
+#if LUA_VERSION_NUM >= 502
+    // The first upvalue of a main chunk is its _ENV
+    if (lua_setupvalue(l, fn_index, 1) == nullptr) {
+        lua_pop(l, 1);
+    }
+#else
+    lua_setfenv(l, fn_index);
+#endif
+}
 
-    // _print(<error-message> + call stack)
-    const char* msg = "<not set>";
-    if (!lua_isnil(L, -1)) {
-        msg = lua_tostring(L, -1);
-        if (!msg)
-            msg = "<error object>";
+// Loads and runs a file. If env is non-zero, it is the stack index of
+// a table used as the chunk's environment. Errors are recorded as the
+// state's last error and reported to its diagnostics sink, or written
+// to std::cout when the state has none.
+inline bool _load(const StateBlock &state, const std::string &file, int env = 0) {
+    lua_State *l = state.GetState();
+    int status = luaL_loadfile(l, file.c_str());
+    if (status == 0) {
+        if (env != 0) {
+            lua_pushvalue(l, env);
+            _set_env(l, -2);
+        }
+        if (_pcall(state, 0, LUA_MULTRET, "load")) {
+            return true;
+        }
+    } else {
+        state.GetLastError().traceback.clear();
+        _record_error(state, status, "load", file);
+    }
+    if (!state.HasDiagnosticsSink()) {
+        std::cout << state.GetLastError().message << '\n';
     }
-    _print(msg);
-    return 1;
+    return false;
 }
 
-inline int SetErrorHandler(lua_State *L) {
-    lua_pushcfunction(L, &ErrorHandler);
-    return lua_gettop(L);
+// Runs a string of code. If env is non-zero, it is the stack index of
+// a table used as the chunk's environment. Errors are recorded as the
+// state's last error.
+inline bool _dostring(const StateBlock &state, const char *code, int env = 0) {
+    lua_State *l = state.GetState();
+    int status = luaL_loadstring(l, code);
+    if (status != 0) {
+        state.GetLastError().traceback.clear();
+        _record_error(state, status, "run");
+        return false;
+    }
+    if (env != 0) {
+        lua_pushvalue(l, env);
+        _set_env(l, -2);
+    }
+    return _pcall(state, 0, LUA_MULTRET, "run");
+}
 }
 }
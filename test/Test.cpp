@@ -6,6 +6,8 @@
 #include "reference_tests.h"
 #include "selector_tests.h"
 #include "error_tests.h"
+#include "environment_tests.h"
+#include "profiler_tests.h"
 #include <map>
 
 // A very simple testing framework
@@ -19,6 +21,16 @@ static TestMap tests = {
     {"test_call_undefined_function", test_call_undefined_function},
     {"test_call_undefined_function2", test_call_undefined_function2},
     {"test_call_stackoverflow", test_call_stackoverflow},
+    {"test_error_code_and_no_traceback", test_error_code_and_no_traceback},
+    {"test_error_traceback", test_error_traceback},
+    {"test_error_clears_results", test_error_clears_results},
+    {"test_error_from_function_object", test_error_from_function_object},
+    {"test_run_code_error", test_run_code_error},
+    {"test_diagnostics_load_error", test_diagnostics_load_error},
+    {"test_diagnostics_call_error", test_diagnostics_call_error},
+    {"test_diagnostics_stream_sink", test_diagnostics_stream_sink},
+    {"test_diagnostics_async_sink", test_diagnostics_async_sink},
+    {"test_diagnostics_async_sink_drops_when_full", test_diagnostics_async_sink_drops_when_full},
 
     {"test_function_no_args", test_function_no_args},
     {"test_add", test_add},
@@ -40,6 +52,41 @@ static TestMap tests = {
     {"test_pointer_return", test_pointer_return},
     {"test_reference_return", test_reference_return},
     {"test_nullptr_to_nil", test_nullptr_to_nil},
+    {"test_static_fun", test_static_fun},
+    {"test_static_fun_no_return", test_static_fun_no_return},
+    {"test_static_fun_multi_return", test_static_fun_multi_return},
+    {"test_static_fun_pointer_return", test_static_fun_pointer_return},
+    {"test_rebinding_frees_old_functions", test_rebinding_frees_old_functions},
+    {"test_overload_by_type_and_arity", test_overload_by_type_and_arity},
+    {"test_overload_first_match_wins", test_overload_first_match_wins},
+    {"test_overload_no_match", test_overload_no_match},
+    {"test_overload_no_match_many_arguments", test_overload_no_match_many_arguments},
+    {"test_const_char_argument", test_const_char_argument},
+    {"test_lua_string_pinned", test_lua_string_pinned},
+    {"test_lua_string_from_function", test_lua_string_from_function},
+    {"test_varargs_typed_access", test_varargs_typed_access},
+    {"test_varargs_forwarded", test_varargs_forwarded},
+    {"test_overload_varargs", test_overload_varargs},
+    {"test_vector_round_trip", test_vector_round_trip},
+    {"test_vector_argument_and_return", test_vector_argument_and_return},
+    {"test_nested_containers", test_nested_containers},
+    {"test_unordered_map_and_pair", test_unordered_map_and_pair},
+    {"test_vector_of_class_by_value", test_vector_of_class_by_value},
+    {"test_container_argument_must_be_table", test_container_argument_must_be_table},
+    {"test_container_ref_sequence", test_container_ref_sequence},
+    {"test_container_ref_map", test_container_ref_map},
+    {"test_container_ref_argument", test_container_ref_argument},
+    {"test_container_ref_checked", test_container_ref_checked},
+    {"test_num_array_access", test_num_array_access},
+    {"test_num_array_kernels", test_num_array_kernels},
+    {"test_num_array_view", test_num_array_view},
+    {"test_num_array_checked", test_num_array_checked},
+#if __cplusplus >= 201703L
+    {"test_string_view_argument", test_string_view_argument},
+#endif
+#if __cplusplus >= 201703L
+    {"test_static_fun_shorthand", test_static_fun_shorthand},
+#endif
 
     {"test_metatable_registry_ptr", test_metatable_registry_ptr},
     {"test_metatable_registry_ref", test_metatable_registry_ref},
@@ -54,6 +101,7 @@ static TestMap tests = {
     {"test_register_obj_const_member_variable", test_register_obj_const_member_variable},
     {"test_bind_vector_push_back", test_bind_vector_push_back},
     {"test_bind_vector_push_back_string", test_bind_vector_push_back_string},
+    {"test_static_obj_members", test_static_obj_members},
 
     {"test_select_global", test_select_global},
     {"test_select_field", test_select_field},
@@ -84,12 +132,68 @@ static TestMap tests = {
     {"test_freestanding_fun_ptr", test_freestanding_fun_ptr},
     {"test_const_member_function", test_const_member_function},
     {"test_const_member_variable", test_const_member_variable},
+    {"test_static_class_method", test_static_class_method},
+    {"test_static_class_field", test_static_class_field},
+    {"test_static_class_pointer_field", test_static_class_pointer_field},
+    {"test_static_class_field_of_class_type", test_static_class_field_of_class_type},
+    {"test_static_class_const_members", test_static_class_const_members},
+    {"test_static_class_method_type_check", test_static_class_method_type_check},
+    {"test_class_method_rejects_other_class", test_class_method_rejects_other_class},
+    {"test_class_property", test_class_property},
+    {"test_class_property_pointer", test_class_property_pointer},
+    {"test_class_property_of_class_type", test_class_property_of_class_type},
+    {"test_class_property_read_only", test_class_property_read_only},
+    {"test_class_property_unknown", test_class_property_unknown},
+    {"test_class_inherited_members", test_class_inherited_members},
+    {"test_class_inherited_type_check", test_class_inherited_type_check},
+    {"test_class_unregistered_base", test_class_unregistered_base},
+    {"test_class_releases_metatable_ref", test_class_releases_metatable_ref},
+    {"test_class_shared_ptr", test_class_shared_ptr},
+    {"test_class_shared_ptr_to_base", test_class_shared_ptr_to_base},
+    {"test_class_unique_ptr", test_class_unique_ptr},
+    {"test_class_foreign_userdata", test_class_foreign_userdata},
+    {"test_class_argument_type_checked", test_class_argument_type_checked},
+    {"test_class_pooled", test_class_pooled},
+    {"test_pool_throwing_constructor", test_pool_throwing_constructor},
+    {"test_class_over_aligned", test_class_over_aligned},
+    {"test_class_returned_pointers", test_class_returned_pointers},
+    {"test_class_identity_cache", test_class_identity_cache},
+    {"test_class_operators", test_class_operators},
+    {"test_class_operators_undefined", test_class_operators_undefined},
+#if __cplusplus >= 201703L
+    {"test_static_class_member_shorthand", test_static_class_member_shorthand},
+    {"test_class_property_shorthand", test_class_property_shorthand},
+#endif
 
     {"test_function_reference", test_function_reference},
     {"test_function_in_constructor", test_function_in_constructor},
     {"test_pass_function_to_lua", test_pass_function_to_lua},
     {"test_call_returned_lua_function", test_call_returned_lua_function},
-    {"test_call_multivalue_lua_function", test_call_multivalue_lua_function}
+    {"test_call_multivalue_lua_function", test_call_multivalue_lua_function},
+    {"test_batch_lua_function", test_batch_lua_function},
+    {"test_batch_keeps_caller_stack", test_batch_keeps_caller_stack},
+    {"test_prepared_call", test_prepared_call},
+    {"test_prepared_call_after_stack_reset", test_prepared_call_after_stack_reset},
+    {"test_prepared_call_inside_binding", test_prepared_call_inside_binding},
+
+    {"test_environment_isolates_globals", test_environment_isolates_globals},
+    {"test_environment_reads_globals", test_environment_reads_globals},
+    {"test_environment_load", test_environment_load},
+    {"test_environment_independent", test_environment_independent},
+    {"test_environment_set_field", test_environment_set_field},
+    {"test_environment_shadows_g", test_environment_shadows_g},
+    {"test_environment_hides_globals", test_environment_hides_globals},
+
+    {"test_profiler_samples_lua", test_profiler_samples_lua},
+    {"test_profiler_binding_frames", test_profiler_binding_frames},
+    {"test_profiler_static_binding_frames", test_profiler_static_binding_frames},
+    {"test_profiler_stopped", test_profiler_stopped},
+    {"test_profiler_keeps_user_hook", test_profiler_keeps_user_hook},
+#ifdef SELENE_INSTRUMENT
+    {"test_binding_stats_function", test_binding_stats_function},
+    {"test_binding_stats_class", test_binding_stats_class},
+    {"test_binding_stats_reset", test_binding_stats_reset},
+#endif
 };
 
 // Executes all tests and returns the number of failures.
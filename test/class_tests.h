@@ -157,3 +157,540 @@ bool test_const_member_variable(sel::State &state) {
     state("tmp2 = ConstMemberTest.new().set_foo == nil");
     return state["tmp1"] && state["tmp2"];
 }
+
+bool test_static_class_method(sel::State &state) {
+    state["Bar"].SetClass<Bar, int>(
+        "print", sel::Method<decltype(&Bar::Print), &Bar::Print>{},
+        "get_x", sel::Method<decltype(&Bar::GetX), &Bar::GetX>{},
+        "set_x", sel::Method<decltype(&Bar::SetX), &Bar::SetX>{});
+    state("bar = Bar.new(8); bar:set_x(9)");
+    state("barx = bar:get_x(); barp = bar:print(2)");
+    return state["barx"] == 9 && state["barp"] == "9+2";
+}
+
+bool test_static_class_field(sel::State &state) {
+    state["Bar"].SetClass<Bar, int>("x", sel::Field<decltype(&Bar::x), &Bar::x>{});
+    state("bar = Bar.new(-2)");
+    state("bar:set_x(-4)");
+    state("barx = bar:x()");
+    return state["barx"] == -4;
+}
+
+struct Cage {
+    Bar *bar;
+    Cage(Bar *b) : bar(b) {}
+};
+
+bool test_static_class_pointer_field(sel::State &state) {
+    state["Bar"].SetClass<Bar, int>("get_x", &Bar::GetX);
+    state["Cage"].SetClass<Cage, Bar*>(
+        "bar", sel::Field<decltype(&Cage::bar), &Cage::bar>{});
+    state("bar = Bar.new(5); cage = Cage.new(bar)");
+    state("barx = cage:bar():get_x()");
+    return state["barx"] == 5;
+}
+
+struct Line {
+    const Bar a;
+    Bar b;
+    Line(int x) : a(x), b(x + 1) {}
+};
+
+bool test_static_class_field_of_class_type(sel::State &state) {
+    state["Bar"].SetClass<Bar, int>("get_x", &Bar::GetX);
+    state["Line"].SetClass<Line, int>(
+        "a", sel::Field<decltype(&Line::a), &Line::a>{},
+        "b", sel::Field<decltype(&Line::b), &Line::b>{});
+    state("local l = Line.new(42); a = l:a(); l = nil; collectgarbage(); "
+          "collectgarbage(); ax = a:get_x()");
+    state("l = Line.new(1); l:set_b(Bar.new(7)); lbx = l:b():get_x()");
+    return state["ax"] == 42 && state["lbx"] == 7;
+}
+
+bool test_static_class_const_members(sel::State &state) {
+    state["ConstMemberTest"].SetClass<ConstMemberTest>(
+        "get_bool", sel::Method<decltype(&ConstMemberTest::get_bool),
+                                &ConstMemberTest::get_bool>{},
+        "foo", sel::Field<decltype(&ConstMemberTest::foo),
+                          &ConstMemberTest::foo>{});
+    state("tmp = ConstMemberTest.new()");
+    state("tmp1 = tmp:get_bool() and tmp:foo()");
+    state("tmp2 = tmp.set_foo == nil");
+    return state["tmp1"] && state["tmp2"];
+}
+
+bool test_static_class_method_type_check(sel::State &state) {
+    state["Bar"].SetClass<Bar, int>(
+        "get_x", sel::Method<decltype(&Bar::GetX), &Bar::GetX>{});
+    state("bar = Bar.new(8)");
+    return !state("x = bar.get_x({})");
+}
+
+bool test_class_method_rejects_other_class(sel::State &state) {
+    state["Bar"].SetClass<Bar, int>("get_x", &Bar::GetX);
+    state["Zoo"].SetClass<Zoo, Bar*>("get_x", &Zoo::GetX);
+    state("bar = Bar.new(4); zoo = Zoo.new(bar)");
+    bool ok = state("x = zoo:get_x()");
+    bool rejected = !state("Bar.get_x(zoo)");
+    return ok && state["x"] == 4 && rejected
+        && state.LastError().message.find("Bar_lib expected, got userdata")
+        != std::string::npos;
+}
+
+bool test_class_property(sel::State &state) {
+    state["Bar"].SetClass<Bar, int>(
+        "x", sel::Property<decltype(&Bar::x), &Bar::x>{},
+        "get_x", &Bar::GetX);
+    state("bar = Bar.new(6); bar.x = bar.x + 1");
+    state("barx = bar:get_x(); missing = bar.y == nil");
+    return state["barx"] == 7 && state["missing"];
+}
+
+bool test_class_property_pointer(sel::State &state) {
+    state["Bar"].SetClass<Bar, int>("get_x", &Bar::GetX);
+    state["Cage"].SetClass<Cage, Bar*>(
+        "bar", sel::Property<decltype(&Cage::bar), &Cage::bar>{});
+    state("bar = Bar.new(3); cage = Cage.new(bar)");
+    state("barx = cage.bar:get_x()");
+    state("bar2 = Bar.new(8); cage.bar = bar2; barx2 = cage.bar:get_x()");
+    return state["barx"] == 3 && state["barx2"] == 8;
+}
+
+bool test_class_property_of_class_type(sel::State &state) {
+    state["Bar"].SetClass<Bar, int>("get_x", &Bar::GetX);
+    state["Line"].SetClass<Line, int>(
+        "a", sel::Property<decltype(&Line::a), &Line::a>{},
+        "b", sel::Property<decltype(&Line::b), &Line::b>{});
+    state("local l = Line.new(42); a = l.a; b = l.b; l = nil; collectgarbage(); "
+          "collectgarbage(); ax = a:get_x(); bx = b:get_x()");
+    state("l = Line.new(1); l.b = Bar.new(7); lbx = l.b:get_x()");
+    return state["ax"] == 42 && state["bx"] == 43 && state["lbx"] == 7;
+}
+
+bool test_class_property_read_only(sel::State &state) {
+    state["ConstMemberTest"].SetClass<ConstMemberTest>(
+        "foo", sel::Property<decltype(&ConstMemberTest::foo),
+                             &ConstMemberTest::foo>{});
+    state("tmp = ConstMemberTest.new()");
+    state("tmp1 = tmp.foo");
+    bool rejected = !state("tmp.foo = false");
+    return state["tmp1"] == true && rejected
+        && state.LastError().message.find("property 'foo' is read-only")
+        != std::string::npos;
+}
+
+bool test_class_property_unknown(sel::State &state) {
+    state["Bar"].SetClass<Bar, int>(
+        "x", sel::Property<decltype(&Bar::x), &Bar::x>{});
+    state("bar = Bar.new(1)");
+    return !state("bar.y = 2")
+        && state.LastError().message.find("has no property 'y'")
+        != std::string::npos;
+}
+
+struct Animal {
+    int legs = 4;
+    int Legs() const {
+        return legs;
+    }
+    std::string Sound() {
+        return "...";
+    }
+};
+
+struct Named {
+    std::string name = "rex";
+    std::string Name() const {
+        return name;
+    }
+    void Rename(std::string n) {
+        name = n;
+    }
+};
+
+struct Dog : Animal, Named {
+    std::string Sound() {
+        return "woof";
+    }
+};
+
+struct Puppy : Dog {
+    int Age() const {
+        return 1;
+    }
+};
+
+static void register_animals(sel::State &state) {
+    state["Animal"].SetClass<Animal>(
+        "legs", &Animal::Legs,
+        "sound", sel::Method<decltype(&Animal::Sound), &Animal::Sound>{});
+    state["Named"].SetClass<Named>(
+        "name", &Named::Name,
+        "rename", sel::Method<decltype(&Named::Rename), &Named::Rename>{},
+        "title", sel::Property<decltype(&Named::name), &Named::name>{});
+    state["Dog"].SetClass<Dog>(sel::Bases<Animal, Named>{},
+                               "sound", &Dog::Sound);
+    state["Puppy"].SetClass<Puppy>(sel::Bases<Dog>{}, "age", &Puppy::Age);
+}
+
+bool test_class_inherited_members(sel::State &state) {
+    register_animals(state);
+    state("p = Puppy.new(); p:rename('fido')");
+    state("legs = p:legs(); sound = p:sound(); age = p:age()");
+    state("name = p:name(); title = p.title; p.title = 'max'");
+    state("renamed = Named.name(p); flat = rawget(getmetatable(p), 'name') ~= nil");
+    return state["legs"] == 4 && state["sound"] == "woof" && state["age"] == 1
+        && state["name"] == "fido" && state["title"] == "fido"
+        && state["renamed"] == "max" && state["flat"];
+}
+
+bool test_class_inherited_type_check(sel::State &state) {
+    register_animals(state);
+    state("a = Animal.new(); d = Dog.new()");
+    bool upcast = state("legs = Animal.legs(d)");
+    bool rejected = !state("Dog.sound(a)");
+    return upcast && state["legs"] == 4 && rejected;
+}
+
+bool test_class_unregistered_base(sel::State &state) {
+    bool thrown = false;
+    try {
+        state["Dog"].SetClass<Dog>(sel::Bases<Animal>{}, "sound", &Dog::Sound);
+    } catch (std::runtime_error &e) {
+        thrown = std::string(e.what()).find("is not registered") !=
+            std::string::npos;
+    }
+    state["Animal"].SetClass<Animal>("legs", &Animal::Legs);
+    state["Dog"].SetClass<Dog>(sel::Bases<Animal>{}, "sound", &Dog::Sound);
+    state("legs = Dog.new():legs()");
+    return thrown && state["legs"] == 4;
+}
+
+// Registers a class three times under the same name, then checks that
+// the three metatable refs are free for reuse once the state is gone
+bool test_class_releases_metatable_ref(sel::State &) {
+    lua_State *l = luaL_newstate();
+    luaL_openlibs(l);
+    int fresh;
+    {
+        sel::State state{l};
+        for (int i = 0; i < 3; ++i) {
+            state["Bar"].SetClass<Bar, int>("get_x", &Bar::GetX);
+        }
+        lua_pushboolean(l, 1);
+        fresh = luaL_ref(l, LUA_REGISTRYINDEX);
+        luaL_unref(l, LUA_REGISTRYINDEX, fresh);
+    }
+    int reused = 0;
+    for (int i = 0; i < 4; ++i) {
+        lua_pushboolean(l, 1);
+        if (luaL_ref(l, LUA_REGISTRYINDEX) < fresh) ++reused;
+    }
+    lua_close(l);
+    return reused == 3;
+}
+
+bool test_class_shared_ptr(sel::State &state) {
+    state["Bar"].SetClass<Bar, int>("set_x", &Bar::SetX, "get_x", &Bar::GetX);
+    auto bar = std::make_shared<Bar>(3);
+    state["shared"] = bar;
+    state("shared:set_x(shared:get_x() + 6)");
+    std::shared_ptr<Bar> back = state["shared"];
+    const bool shared = bar->x == 9 && back == bar && bar.use_count() == 3;
+    state("shared = nil");
+    state.ForceGC();
+    return shared && bar.use_count() == 2;
+}
+
+bool test_class_shared_ptr_to_base(sel::State &state) {
+    register_animals(state);
+    auto puppy = std::make_shared<Puppy>();
+    std::shared_ptr<Named> seen;
+    state["keep"] = [&seen](std::shared_ptr<Named> named) { seen = named; };
+    state["puppy"] = puppy;
+    state("keep(puppy)");
+    std::shared_ptr<Animal> animal = state["puppy"];
+    // The second base sits at an offset, so aliasing must upcast
+    const bool shared = seen.get() == static_cast<Named *>(puppy.get())
+        && animal.get() == static_cast<Animal *>(puppy.get())
+        && puppy.use_count() == 4;
+    state("puppy = nil");
+    state.ForceGC();
+    seen.reset();
+    return shared && puppy.use_count() == 2;
+}
+
+bool test_class_unique_ptr(sel::State &state) {
+    gc_counter = 0;
+    state["Bar"].SetClass<Bar, int>("get_x", &Bar::GetX);
+    state["make_bar"] = [](int x) { return std::unique_ptr<Bar>(new Bar(x)); };
+    state("barx = make_bar(5):get_x()");
+    // GCTest is not registered, so Lua only releases it
+    state["owned"] = std::unique_ptr<GCTest>(new GCTest);
+    const bool alive = gc_counter == 1;
+    state("owned = nil");
+    state.ForceGC();
+    return state["barx"] == 5 && alive && gc_counter == 0;
+}
+
+// A userdata of another library, too short to hold a header
+static int new_foreign(lua_State *l) {
+    *static_cast<char *>(lua_newuserdata(l, 1)) = 'f';
+    return 1;
+}
+
+bool test_class_foreign_userdata(sel::State &) {
+    lua_State *l = luaL_newstate();
+    luaL_openlibs(l);
+    bool ok;
+    {
+        sel::State state{l};
+        state["Bar"].SetClass<Bar, int>("get_x", &Bar::GetX);
+        const void *seen = nullptr;
+        const void *raw = nullptr;
+        state["take"] = [&seen](Bar *bar) { seen = bar; };
+        // An unregistered type gets whatever the block holds
+        state["take_raw"] = [&raw](Zoo *zoo) { raw = zoo; };
+        lua_pushcfunction(l, &new_foreign);
+        lua_setglobal(l, "new_foreign");
+        state("foreign = new_foreign(); take_raw(foreign)");
+        lua_getglobal(l, "foreign");
+        ok = raw == lua_touserdata(l, -1) && !state("take(foreign)")
+            && seen == nullptr;
+        lua_pop(l, 1);
+        state("bar = Bar.new(4); take(bar)");
+        ok = ok && seen != nullptr && static_cast<const Bar *>(seen)->x == 4;
+        state("bar = nil");
+        state.ForceGC();
+    }
+    lua_close(l);
+    return ok;
+}
+
+bool test_class_argument_type_checked(sel::State &state) {
+    state["Bar"].SetClass<Bar, int>("get_x", &Bar::GetX);
+    state["Zoo"].SetClass<Zoo, Bar*>("get_x", &Zoo::GetX,
+                                     "change_bar", &Zoo::ChangeBar);
+    state["Line"].SetClass<Line, int>(
+        "b", sel::Property<decltype(&Line::b), &Line::b>{});
+    state("bar = Bar.new(2); zoo = Zoo.new(bar); line = Line.new(5)");
+    bool ok = !state("zoo:change_bar(zoo)")
+        && state.LastError().message.find("expected, got userdata")
+        != std::string::npos;
+    ok = ok && !state("zoo:change_bar(nil)") && !state("zoo:change_bar(3)")
+        && !state("line.b = 3") && !state("line.b = zoo");
+    state("zoo:change_bar(bar); barx = bar:get_x(); lbx = line.b:get_x()");
+    return ok && state["barx"] == 4 && state["lbx"] == 6;
+}
+
+bool test_class_pooled(sel::State &state) {
+    gc_counter = 0;
+    state["Bar"].SetClass<Bar, int>(sel::Pooled{4}, "get_x", &Bar::GetX,
+                                    "x", &Bar::x);
+    state["GCTest"].SetClass<GCTest>(sel::Pooled{});
+    state("bars = {} for i = 1, 10 do bars[i] = Bar.new(i) end");
+    state("gcs = {} for i = 1, 3 do gcs[i] = GCTest.new() end");
+    state("sum = 0 for i = 1, 10 do sum = sum + bars[i]:get_x() end");
+    auto stats = state.GetPoolStats();
+    const bool filled = stats.size() == 2 && stats[0].name == "Bar"
+        && stats[0].live == 10 && stats[0].slabs == 3
+        && stats[0].capacity == 12 && gc_counter == 3;
+    state("bars = nil gcs = nil");
+    state.ForceGC();
+    state("bar = Bar.new(42)");
+    stats = state.GetPoolStats();
+    return state["sum"] == 55 && filled && gc_counter == 0
+        && stats[0].live == 1 && stats[0].slabs == 3
+        && stats[0].allocations == 11 && stats[0].releases == 10
+        && stats[1].live == 0;
+}
+
+struct ThrowingCtor {
+    explicit ThrowingCtor(int x) {
+        if (x < 0) throw std::runtime_error("negative");
+    }
+};
+
+bool test_pool_throwing_constructor(sel::State &) {
+    sel::detail::ObjectPool<ThrowingCtor> pool{"ThrowingCtor", 1};
+    ThrowingCtor *first = pool.New(1);
+    pool.Delete(first);
+    bool thrown = false;
+    try {
+        pool.New(-1);
+    } catch (std::runtime_error &) {
+        thrown = true;
+    }
+    // The slot is reused rather than lost, so no second slab is needed
+    ThrowingCtor *second = pool.New(2);
+    const sel::PoolStats stats = pool.Stats();
+    pool.Delete(second);
+    return thrown && second == first && stats.slabs == 1 && stats.live == 1;
+}
+
+struct alignas(64) AlignedVec {
+    float v[16];
+    AlignedVec(float x) {
+        for (float &f : v) f = x;
+    }
+    bool IsAligned() const {
+        return reinterpret_cast<std::uintptr_t>(this) % 64 == 0;
+    }
+    float Sum() const {
+        float sum = 0;
+        for (float f : v) sum += f;
+        return sum;
+    }
+};
+
+bool test_class_over_aligned(sel::State &state) {
+    state["Vec"].SetClass<AlignedVec, float>(
+        "aligned", &AlignedVec::IsAligned, "sum", &AlignedVec::Sum);
+    state["PooledVec"].SetClass<AlignedVec, float>(
+        sel::Pooled{3}, "aligned", &AlignedVec::IsAligned);
+    state(R"(
+        aligned = true
+        for i = 1, 20 do
+            aligned = aligned and Vec.new(i):aligned()
+                and PooledVec.new(i):aligned()
+        end
+        sum = Vec.new(0.5):sum()
+    )");
+    return state["aligned"] && state["sum"] == 8;
+}
+
+bool test_class_returned_pointers(sel::State &state) {
+    Bar bar(3);
+    Zoo zoo(&bar);
+    state["Bar"].SetClass<Bar, int>("get_x", &Bar::GetX);
+    state["Zoo"].SetClass<Zoo, Bar*>("get_x", &Zoo::GetX,
+                                     "change_bar", &Zoo::ChangeBar);
+    state["bar_ptr"] = [&bar]() { return &bar; };
+    state["zoo_ref"] = [&zoo]() -> Zoo& { return zoo; };
+    // Each pointer gets the metatable of its own class
+    state("b = bar_ptr(); z = zoo_ref(); z:change_bar(b)");
+    state("boxed = type(b) == 'userdata' and type(z) == 'userdata'");
+    state("barx = b:get_x(); zoox = z:get_x()");
+    bool rejected = !state("Zoo.get_x(b)");
+    state("b = nil z = nil");
+    state.ForceGC();
+    return state["boxed"] && state["barx"] == 6 && state["zoox"] == 3
+        && bar.x == 6 && rejected;
+}
+
+struct Link {
+    Link *next = this;
+    Link *Next() {
+        return next;
+    }
+};
+
+bool test_class_identity_cache(sel::State &state) {
+    gc_counter = 0;
+    Bar bar(3);
+    state["Bar"].SetClass<Bar, int>("get_x", &Bar::GetX);
+    state["GCTest"].SetClass<GCTest>();
+    state["Link"].SetClass<Link>("next", &Link::Next);
+    state["bar_ptr"] = [&bar]() { return &bar; };
+    state["same_bar"] = [](Bar *b) -> Bar& { return *b; };
+    state("uncached = bar_ptr() ~= bar_ptr()");
+    state.EnableIdentityCache();
+    state("b = bar_ptr(); cached = b == bar_ptr()");
+    state("made = Bar.new(5); roundtrip = same_bar(made) == made");
+    state("link = Link.new(); linked = link:next():next() == link");
+    // The cache keeps nothing alive
+    state("g = GCTest.new(); b = nil; made = nil; g = nil");
+    state.ForceGC();
+    state("after = bar_ptr():get_x()");
+    return state["uncached"] && state["cached"] && state["roundtrip"]
+        && state["linked"] && gc_counter == 0 && state["after"] == 3;
+}
+
+struct Vec2 {
+    double x, y;
+    Vec2(double x, double y) : x(x), y(y) {}
+    Vec2 operator+(const Vec2 &other) const {
+        return Vec2(x + other.x, y + other.y);
+    }
+    Vec2 operator-() const {
+        return Vec2(-x, -y);
+    }
+    double operator()(double scale) const {
+        return x * scale;
+    }
+    std::size_t size() const {
+        return 2;
+    }
+    double X() const {
+        return x;
+    }
+};
+
+Vec2 operator*(const Vec2 &v, double s) {
+    return Vec2(v.x * s, v.y * s);
+}
+
+Vec2 operator*(double s, const Vec2 &v) {
+    return v * s;
+}
+
+bool operator==(const Vec2 &a, const Vec2 &b) {
+    return a.x == b.x && a.y == b.y;
+}
+
+bool operator<(const Vec2 &a, const Vec2 &b) {
+    return a.x < b.x;
+}
+
+std::ostream &operator<<(std::ostream &os, const Vec2 &v) {
+    return os << '(' << v.x << ", " << v.y << ')';
+}
+
+bool test_class_operators(sel::State &state) {
+    state["Vec2"].SetClass<Vec2, double, double>(sel::Operators{}, "x", &Vec2::X);
+    state(R"(
+        a = Vec2.new(1, 2)
+        b = Vec2.new(3, 4)
+        sum = ((a + b) * 2):x()
+        scaled = (2 * a):x()
+        neg = (-a):x()
+        eq = a + b == Vec2.new(4, 6)
+        lt = a < b
+        len = #a
+        str = tostring(a)
+        called = b(2)
+    )");
+    return state["sum"] == 8 && state["scaled"] == 2 && state["neg"] == -1
+        && state["eq"] && state["lt"] && state["len"] == 2
+        && state["str"] == "(1, 2)" && state["called"] == 6;
+}
+
+bool test_class_operators_undefined(sel::State &state) {
+    state["Vec2"].SetClass<Vec2, double, double>(sel::Operators{});
+    state["Bar"].SetClass<Bar, int>();
+    state("a = Vec2.new(1, 2)");
+    bool no_sub = !state("c = a - a");
+    bool no_mixed = !state("c = a + 1");
+    const std::string mixed = state.LastError().message;
+    bool unbound = !state("c = Bar.new(1) + Bar.new(2)");
+    return no_sub && no_mixed && unbound
+        && mixed.find("__add is not defined for userdata and number")
+        != std::string::npos;
+}
+
+#if __cplusplus >= 201703L
+bool test_static_class_member_shorthand(sel::State &state) {
+    state["Bar"].SetClass<Bar, int>("get_x", sel::method<&Bar::GetX>,
+                                    "x", sel::field<&Bar::x>);
+    state("bar = Bar.new(3); bar:set_x(bar:get_x() + 1)");
+    state("barx = bar:x()");
+    return state["barx"] == 4;
+}
+
+bool test_class_property_shorthand(sel::State &state) {
+    state["Bar"].SetClass<Bar, int>("x", sel::property<&Bar::x>);
+    state("bar = Bar.new(3); bar.x = bar.x * 2");
+    state("barx = bar.x");
+    return state["barx"] == 6;
+}
+#endif
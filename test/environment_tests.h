@@ -0,0 +1,55 @@
+#pragma once
+
+#include <selene.h>
+
+bool test_environment_isolates_globals(sel::State &state) {
+    state("x = 1");
+    auto env = state.NewEnvironment();
+    env("x = 2; y = x");
+    return state["x"] == 1 && env["x"] == 2 && env["y"] == 2 &&
+        state.CheckNil("y");
+}
+
+bool test_environment_reads_globals(sel::State &state) {
+    state["g"] = 5;
+    auto env = state.NewEnvironment();
+    env("y = g + 1");
+    return env["y"] == 6;
+}
+
+bool test_environment_load(sel::State &state) {
+    auto env = state.NewEnvironment();
+    const bool loaded = env.Load("../test/test.lua");
+    return loaded && env["my_global"] == 4 && env["add"](1, 2) == 3 &&
+        state.CheckNil("my_global");
+}
+
+bool test_environment_independent(sel::State &state) {
+    auto env1 = state.NewEnvironment();
+    auto env2 = state.NewEnvironment();
+    env1("x = 1");
+    env2("x = 2");
+    return env1["x"] == 1 && env2["x"] == 2 && state.CheckNil("x");
+}
+
+bool test_environment_set_field(sel::State &state) {
+    auto env = state.NewEnvironment();
+    env["z"] = 3;
+    env("w = z * 2");
+    return env["w"] == 6 && state.CheckNil("z");
+}
+
+bool test_environment_shadows_g(sel::State &state) {
+    state("x = 5");
+    auto env = state.NewEnvironment();
+    env("_G.x = 1; y = x; _G.z = 2");
+    return state["x"] == 5 && env["x"] == 1 && env["y"] == 1 &&
+        state.CheckNil("z") && env["z"] == 2;
+}
+
+bool test_environment_hides_globals(sel::State &state) {
+    state("x = 5");
+    auto env = state.NewEnvironment();
+    env("mt = getmetatable(_G)");
+    return env["mt"] == false && state["x"] == 5;
+}
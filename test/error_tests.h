@@ -1,7 +1,12 @@
 #pragma once
 
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <selene.h>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <sstream>
 
@@ -44,21 +49,144 @@ bool test_call_undefined_function(sel::State &state) {
     const char* expected = "attempt to call a nil value";
     CapturedStdout capture;
     state["undefined_function"]();
-    return capture.Content().find(expected) != std::string::npos;
+    return state.LastError().message.find(expected) != std::string::npos
+        && capture.Content().empty();
 }
 
 bool test_call_undefined_function2(sel::State &state) {
     state.Load("../test/test_error.lua");
     const char* expected = "attempt to call global 'err_func2'";
-    CapturedStdout capture;
     state["err_func1"](1, 2);
-    return capture.Content().find(expected) != std::string::npos;
+    return state.LastError().message.find(expected) != std::string::npos;
 }
 
 bool test_call_stackoverflow(sel::State &state) {
     state.Load("../test/test_error.lua");
     const char* expected = "test_error.lua:10: stack overflow";
-    CapturedStdout capture;
     state["do_overflow"]();
-    return capture.Content().find(expected) != std::string::npos;
+    return state.LastError().message.find(expected) != std::string::npos;
+}
+
+bool test_error_code_and_no_traceback(sel::State &state) {
+    state.Load("../test/test_error.lua");
+    state["err_func1"](1, 2);
+    const sel::LuaError &error = state.LastError();
+    return bool(error) && error.code == LUA_ERRRUN && error.traceback.empty();
+}
+
+bool test_error_traceback(sel::State &state) {
+    state.Load("../test/test_error.lua");
+    state.EnableTracebacks();
+    state["err_func1"](1, 2);
+    const sel::LuaError &error = state.LastError();
+    return error.message.find("stack traceback") == std::string::npos
+        && error.traceback.find("stack traceback") != std::string::npos
+        && error.traceback.find("test_error.lua:2:") != std::string::npos;
+}
+
+bool test_error_clears_results(sel::State &state) {
+    state("function fails() error('boom') end");
+    int a, b;
+    sel::tie(a, b) = state["fails"]();
+    return a == 0 && b == 0
+        && state.LastError().message.find("boom") != std::string::npos
+        && state.Size() == 0;
+}
+
+bool test_error_from_function_object(sel::State &state) {
+    state("function fails(x) error(x, 0) end");
+    sel::function<void(std::string)> fails = state["fails"];
+    fails("from function");
+    return state.LastError().message == "from function";
+}
+
+bool test_run_code_error(sel::State &state) {
+    bool ok = state("error('in chunk')");
+    bool syntax = state("x = = 1");
+    const sel::LuaError &error = state.LastError();
+    bool result = !ok && !syntax && error.code == LUA_ERRSYNTAX;
+    state.ClearError();
+    return result && !state.LastError() && state.Size() == 0;
+}
+
+class CollectingSink : public sel::DiagnosticsSink {
+public:
+    std::mutex mutex;
+    std::vector<sel::Diagnostic> diagnostics;
+
+    void Write(const sel::Diagnostic &d) override {
+        std::lock_guard<std::mutex> lock(mutex);
+        diagnostics.push_back(d);
+    }
+};
+
+bool test_diagnostics_load_error(sel::State &state) {
+    auto sink = std::make_shared<CollectingSink>();
+    state.SetDiagnosticsSink(sink);
+    CapturedStdout capture;
+    bool loaded = state.Load("../test/test_syntax_error.lua");
+    return !loaded && capture.Content().empty()
+        && sink->diagnostics.size() == 1
+        && sink->diagnostics[0].level == sel::LogLevel::Error
+        && std::string(sink->diagnostics[0].event) == "load"
+        && sink->diagnostics[0].source == "../test/test_syntax_error.lua"
+        && sink->diagnostics[0].code == LUA_ERRSYNTAX;
+}
+
+bool test_diagnostics_call_error(sel::State &state) {
+    auto sink = std::make_shared<CollectingSink>();
+    state.SetDiagnosticsSink(sink);
+    state("function fails() error('boom', 0) end");
+    state["fails"]();
+    return sink->diagnostics.size() == 1
+        && std::string(sink->diagnostics[0].event) == "call"
+        && sink->diagnostics[0].message == "boom";
+}
+
+bool test_diagnostics_stream_sink(sel::State &state) {
+    std::stringstream out;
+    state.SetDiagnosticsSink(std::make_shared<sel::StreamSink>(out));
+    state("error('in chunk', 0)");
+    return out.str() == "error run: in chunk\n";
+}
+
+class BlockingSink : public sel::DiagnosticsSink {
+public:
+    std::mutex gate;
+    std::atomic<int> written{0};
+
+    void Write(const sel::Diagnostic &) override {
+        std::lock_guard<std::mutex> lock(gate);
+        ++written;
+    }
+};
+
+bool test_diagnostics_async_sink(sel::State &) {
+    auto target = std::make_shared<CollectingSink>();
+    sel::AsyncSink sink(target, 64);
+    std::vector<std::thread> producers;
+    for (int t = 0; t < 4; ++t) {
+        producers.emplace_back([&sink]() {
+            sel::Diagnostic d;
+            d.message = "x";
+            for (int i = 0; i < 10; ++i) sink.Write(d);
+        });
+    }
+    for (auto &p : producers) p.join();
+    sink.Flush();
+    return target->diagnostics.size() == 40 && sink.Dropped() == 0;
+}
+
+bool test_diagnostics_async_sink_drops_when_full(sel::State &) {
+    auto target = std::make_shared<BlockingSink>();
+    std::size_t dropped;
+    {
+        std::unique_lock<std::mutex> hold(target->gate);
+        sel::AsyncSink sink(target, 4);
+        for (int i = 0; i < 20; ++i) sink.Write(sel::Diagnostic{});
+        dropped = sink.Dropped();
+        hold.unlock();
+        sink.Flush();
+    }
+    return dropped > 0 && target->written + dropped == 20;
 }
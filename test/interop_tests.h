@@ -1,7 +1,13 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <map>
 #include <selene.h>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 int my_add(int a, int b) {
     return a + b;
@@ -175,3 +181,365 @@ bool test_nullptr_to_nil(sel::State &state) {
     state("result = x == nil");
     return static_cast<bool>(state["result"]);
 }
+
+bool test_static_fun(sel::State &state) {
+    state["cadd"] = sel::Fn<decltype(&my_add), &my_add>{};
+    state("x = cadd(4, 20) + cadd(1, 1)");
+    const int answer = state["cadd"](4, 20);
+    return answer == 24 && state["x"] == 26;
+}
+
+static int static_calls = 0;
+void count_static_call() { ++static_calls; }
+
+bool test_static_fun_no_return(sel::State &state) {
+    static_calls = 0;
+    state["count"] = sel::Fn<decltype(&count_static_call), &count_static_call>{};
+    state("for i = 1, 3 do count() end");
+    return static_calls == 3;
+}
+
+bool test_static_fun_multi_return(sel::State &state) {
+    state["sd"] = sel::Fn<decltype(&my_sum_and_difference),
+                          &my_sum_and_difference>{};
+    state("s, d = sd(5, 3)");
+    return state["s"] == 8 && state["d"] == 2;
+}
+
+bool test_static_fun_pointer_return(sel::State &state) {
+    state["return_special_pointer"] =
+        sel::Fn<decltype(&return_special_pointer), &return_special_pointer>{};
+    return state["return_special_pointer"]() == &special;
+}
+
+#if __cplusplus >= 201703L
+bool test_static_fun_shorthand(sel::State &state) {
+    state["cadd"] = sel::fn<&my_add>;
+    return state["cadd"](1, 2) == 3;
+}
+#endif
+
+struct LiveCounter {
+    static int live;
+    LiveCounter() { ++live; }
+    LiveCounter(const LiveCounter &) { ++live; }
+    ~LiveCounter() { --live; }
+};
+int LiveCounter::live = 0;
+
+bool test_rebinding_frees_old_functions(sel::State &state) {
+    {
+        LiveCounter counter;
+        for (int i = 0; i < 100; ++i) {
+            state["callback"] = [counter](int x) { return x + 1; };
+        }
+    }
+    state.ForceGC();
+    const bool one_left = LiveCounter::live == 1;
+    const bool callable = state["callback"](1) == 2;
+    state("callback = nil");
+    state.ForceGC();
+    return one_left && callable && LiveCounter::live == 0;
+}
+
+std::string describe_number(double) { return "number"; }
+std::string describe_string(std::string s) { return "string:" + s; }
+std::string describe_pair(int a, int b) { return "pair:" + std::to_string(a + b); }
+
+bool test_overload_by_type_and_arity(sel::State &state) {
+    state["describe"] = sel::overload(
+        &describe_number, &describe_string, &describe_pair,
+        [](bool b) { return std::string(b ? "yes" : "no"); },
+        [](Special *s) { return "special:" + std::to_string(s->foo); });
+    state["get_special"] = &return_special_pointer;
+    state("a = describe(1.5)");
+    state("b = describe('x')");
+    state("c = describe(2, 3)");
+    state("d = describe(true)");
+    state("e = describe(get_special())");
+    return state["a"] == "number" && state["b"] == "string:x"
+        && state["c"] == "pair:5" && state["d"] == "yes"
+        && state["e"] == "special:3";
+}
+
+bool test_overload_first_match_wins(sel::State &state) {
+    state["pick"] = sel::overload(
+        [](int) { return 1; },
+        [](double) { return 2; },
+        [](sel::Value) { return 3; });
+    state("a = pick(4)");
+    state("b = pick({})");
+    return state["a"] == 1 && state["b"] == 3;
+}
+
+bool test_overload_no_match(sel::State &state) {
+    state["describe"] = sel::overload(&describe_number, &describe_pair);
+    bool ok = state("describe('x', {})");
+    return !ok && state.LastError().message.find(
+        "no overload of 'describe' takes (string, table)") != std::string::npos;
+}
+
+bool test_overload_no_match_many_arguments(sel::State &state) {
+    state["describe"] = sel::overload(&describe_number, &describe_pair);
+    bool ok = state("local t = {} for i = 1, 200 do t[i] = 'x' end "
+                    "describe((table.unpack or unpack)(t))");
+    const std::string &message = state.LastError().message;
+    return !ok && message.find("takes (string, string, ") != std::string::npos
+        && message.find("string)") != std::string::npos;
+}
+
+bool test_const_char_argument(sel::State &state) {
+    state["length"] = [](const char *s) { return static_cast<int>(std::strlen(s)); };
+    state("n = length('hello')");
+    return state["n"] == 5;
+}
+
+bool test_lua_string_pinned(sel::State &state) {
+    std::vector<sel::LuaString> kept;
+    state["keep"] = [&kept](sel::LuaString s) { kept.push_back(s); };
+    state["give"] = [&kept]() { return kept.front(); };
+    state("keep(string.rep('ab', 3) .. '\\0z')");
+    state.ForceGC();
+    state("s = give()");
+    const sel::LuaString &s = kept.front();
+    std::string given = state["s"];
+    return s.Size() == 8 && s.ToString() == std::string("ababab\0z", 8)
+        && given == s.ToString();
+}
+
+bool test_lua_string_from_function(sel::State &state) {
+    state("function name() return 'selene' end");
+    sel::function<sel::LuaString()> name = state["name"];
+    sel::LuaString s = name();
+    return s.ToString() == "selene" && std::strcmp(s.Data(), "selene") == 0;
+}
+
+bool test_varargs_typed_access(sel::State &state) {
+    state["sum"] = [](std::string label, sel::Varargs args) {
+        int total = 0;
+        for (int i = 0; i < args.Size(); ++i) {
+            if (args.Type(i) == LUA_TNUMBER) total += args.Get<int>(i);
+        }
+        return label + ":" + std::to_string(total);
+    };
+    state("a = sum('none')");
+    state("b = sum('mixed', 1, 'x', 2, nil, 3)");
+    return state["a"] == "none:0" && state["b"] == "mixed:6";
+}
+
+bool test_varargs_forwarded(sel::State &state) {
+    state("function show(...)"
+          "  local t = {}"
+          "  for i = 1, select('#', ...) do"
+          "    local v = select(i, ...)"
+          "    t[i] = type(v) == 'table' and 'k=' .. v.k or tostring(v)"
+          "  end"
+          "  return table.concat(t, ',')"
+          "end");
+    sel::function<std::string(sel::Varargs)> show = state["show"];
+    state["forward"] = [&show, &state](int, sel::Varargs args) {
+        std::string by_function = show(args);
+        std::string by_selector = state["show"](args);
+        // Still readable after both calls
+        std::string first = args.Get<std::string>(0);
+        return by_function + "|" + by_selector + "|" + first;
+    };
+    state("s = forward(0, 'a', false, {k = 7}, nil)");
+    return state["s"] == "a,false,k=7,nil|a,false,k=7,nil|a";
+}
+
+bool test_overload_varargs(sel::State &state) {
+    state["count"] = sel::overload(
+        [](int, int) { return std::string("pair"); },
+        [](std::string label, sel::Varargs args) {
+            return label + ":" + std::to_string(args.Size());
+        });
+    state("a = count('none'); b = count('three', 1, 2, 3); c = count(1, 2)");
+    bool matched = state["a"] == "none:0" && state["b"] == "three:3"
+        && state["c"] == "pair";
+    // The fixed prefix is still required and typed
+    return matched && !state("count()") && !state("count(1, 'x', 3)");
+}
+
+bool test_vector_round_trip(sel::State &state) {
+    std::vector<int> values(1000);
+    for (int i = 0; i < 1000; ++i) values[i] = i * 2;
+    state["values"] = values;
+    state("n = #values; last = values[1000]");
+    std::vector<int> back = state["values"];
+    return state["n"] == 1000 && state["last"] == 1998 && back == values;
+}
+
+bool test_vector_argument_and_return(sel::State &state) {
+    state["doubled"] = [](std::vector<double> v) {
+        for (auto &x : v) x *= 2;
+        return v;
+    };
+    state("t = doubled({1.5, 2, 3})");
+    std::vector<double> t = state["t"];
+    return t == std::vector<double>{3, 4, 6};
+}
+
+bool test_nested_containers(sel::State &state) {
+    std::map<std::string, std::vector<std::string>> groups{
+        {"a", {"x", "y"}}, {"b", {}}};
+    state["groups"] = groups;
+    state("n = #groups.a; second = groups.a[2]; empty = #groups.b");
+    std::map<std::string, std::vector<std::string>> back = state["groups"];
+    return state["n"] == 2 && state["second"] == "y" && state["empty"] == 0
+        && back == groups;
+}
+
+bool test_unordered_map_and_pair(sel::State &state) {
+    state["count"] = [](std::unordered_map<int, std::string> m) {
+        return std::make_pair(static_cast<int>(m.size()), m[10]);
+    };
+    state("p = count({[10] = 'ten', [20] = 'twenty'})");
+    std::pair<int, std::string> p = state["p"];
+    std::array<int, 3> a = state["p"];
+    return p.first == 2 && p.second == "ten" && a[0] == 2 && a[2] == 0;
+}
+
+struct Pt {
+    int x = 0;
+    int X() const { return x; }
+};
+
+bool test_vector_of_class_by_value(sel::State &state) {
+    state["Pt"].SetClass<Pt>("x", &Pt::X);
+    state["make"] = []() {
+        std::vector<Pt> pts(3);
+        for (int i = 0; i < 3; ++i) pts[i].x = i + 1;
+        return pts;
+    };
+    state("v = make(); collectgarbage(); collectgarbage()");
+    state("sum = v[1]:x() + v[2]:x() + v[3]:x()");
+    return state["sum"] == 6;
+}
+
+bool test_container_argument_must_be_table(sel::State &state) {
+    state["sum"] = [](std::vector<int> v) { return static_cast<int>(v.size()); };
+    return !state("sum(3)") && state.LastError().message.find("table expected")
+        != std::string::npos;
+}
+
+bool test_container_ref_sequence(sel::State &state) {
+    std::vector<int> values{10, 20, 30};
+    state["values"] = sel::ContainerRef<std::vector<int>>{values};
+    state("n = #values; second = values[2]; missing = values[4]");
+    state("values[1] = 11; values[4] = 40");
+    state("total = 0; for i, v in ipairs(values) do total = total + i * v end");
+    bool ok = !state("values[6] = 60");
+    return ok && state["n"] == 3 && state["second"] == 20
+        && state["missing"].is(sel::Selector::Type::Nil)
+        && values == std::vector<int>{11, 20, 30, 40}
+        && state["total"] == 11 + 40 + 90 + 160;
+}
+
+bool test_container_ref_map(sel::State &state) {
+    std::map<std::string, int> counts{{"a", 1}, {"b", 2}};
+    state["counts"] = sel::ContainerRef<std::map<std::string, int>>{counts};
+    state("counts.c = counts.a + counts.b; counts.a = nil");
+    state("keys = ''; for k, v in pairs(counts) do keys = keys .. k .. v end");
+    return counts.size() == 2 && counts["c"] == 3 && state["keys"] == "b2c3";
+}
+
+bool test_container_ref_argument(sel::State &state) {
+    std::array<double, 4> samples{{1, 2, 3, 4}};
+    state["samples"] = sel::ContainerRef<std::array<double, 4>>{samples};
+    state["sum"] = [](sel::ContainerRef<std::array<double, 4>> ref) {
+        double total = 0;
+        for (double x : ref) total += x;
+        return total;
+    };
+    state("samples[4] = 10; s = sum(samples)");
+    sel::ContainerRef<std::array<double, 4>> ref = state["samples"];
+    return state["s"] == 16 && &ref.Get() == &samples;
+}
+
+bool test_container_ref_checked(sel::State &state) {
+    std::vector<int> values{10, 20, 30};
+    std::vector<double> other{1.5};
+    state["values"] = sel::ContainerRef<std::vector<int>>{values};
+    state["other"] = sel::ContainerRef<std::vector<double>>{other};
+    state["sum"] = [](sel::ContainerRef<std::vector<int>> ref) {
+        int total = 0;
+        for (int x : ref) total += x;
+        return total;
+    };
+    state("fraction = values[1.5]; s = sum(values)");
+    // Non-integer keys are not truncated to an element
+    bool ok = !state("values[2.5] = 0") && values[1] == 20
+        && state["fraction"].is(sel::Selector::Type::Nil) && state["s"] == 60;
+    // A proxy for another container type is not accepted as this one
+    ok = ok && !state("sum(other)")
+        && !state("getmetatable(values).__len(other)");
+    sel::ContainerRef<std::vector<int>> wrong = state["other"];
+    return ok && !wrong;
+}
+
+bool test_num_array_access(sel::State &state) {
+    sel::NumArray<double> a{3, -1, 4, 1, 5};
+    state["a"] = a;
+    state("n = #a; s = a:sum(); lo = a:min(); hi = a:max(); a[2] = 9");
+    bool out_of_range = !state("a[6] = 1");
+    return state["n"] == 5 && state["s"] == 12 && state["lo"] == -1
+        && state["hi"] == 5 && a[1] == 9 && out_of_range
+        && reinterpret_cast<std::uintptr_t>(a.Data()) % 64 == 0;
+}
+
+bool test_num_array_kernels(sel::State &state) {
+    sel::NumArray<std::int32_t> x{1, 2, 3, 4, 5, 6, 7};
+    sel::NumArray<std::int32_t> y(7);
+    state["x"] = x;
+    state["y"] = y;
+    state("y:add(1); y:axpy(2, x); y:scale(3)");
+    state("d = x:dot(y); positive = x:mask('>', 4):dot(x)");
+    state("x:prefix_sum(); last = x[7]");
+    bool bad_argument = !state("x:axpy(1, nil)");
+    return y[0] == 9 && y[6] == 45 && state["d"] == 3 * (28 + 2 * 140)
+        && state["positive"] == 18 && state["last"] == 28 && bad_argument;
+}
+
+bool test_num_array_view(sel::State &state) {
+    state["make"] = [](int n) {
+        sel::NumArray<float> a(n);
+        for (int i = 0; i < n; ++i) a[i] = static_cast<float>(i);
+        return a;
+    };
+    const float *seen = nullptr;
+    state["total"] = [&seen](sel::NumArray<float> a) {
+        seen = a.Data();
+        float sum = 0;
+        for (float v : a) sum += v;
+        return sum;
+    };
+    state("a = make(100); t = total(a)");
+    sel::NumArray<float> a = state["a"];
+    return state["t"] == 4950 && seen == a.Data() && a.Size() == 100;
+}
+
+bool test_num_array_checked(sel::State &state) {
+    sel::NumArray<double> a{1, 2, 3};
+    sel::NumArray<float> b{1, 2, 3};
+    state["a"] = a;
+    state["b"] = b;
+    state["total"] = [](sel::NumArray<double> x) { return x.Size(); };
+    state("fraction = a[1.5]; c = a:copy(); n = c:sum()");
+    // Arrays of another element type or other userdata are rejected
+    bool ok = !state("a:dot(b)") && !state("total(b)")
+        && !state("a.sum(b)") && !state("a[2.5] = 0");
+    sel::NumArray<double> wrong = state["b"];
+    return ok && state["fraction"].is(sel::Selector::Type::Nil)
+        && state["n"] == 6 && wrong.Size() == 0 && a[1] == 2;
+}
+
+#if __cplusplus >= 201703L
+bool test_string_view_argument(sel::State &state) {
+    state["first_word"] = [](std::string_view s) {
+        return s.substr(0, s.find(' '));
+    };
+    state("w = first_word('hello world')");
+    return state["w"] == "hello";
+}
+#endif
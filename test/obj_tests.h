@@ -85,3 +85,18 @@ bool test_bind_vector_push_back_string(sel::State &state) {
     state["vec"]["push_back"]("hi");
     return test_vector[0] == "hi";
 }
+
+bool test_static_obj_members(sel::State &state) {
+    Foo foo_instance(1);
+    state["foo_instance"].SetObj(
+        foo_instance,
+        "double_add", sel::Method<decltype(&Foo::DoubleAdd), &Foo::DoubleAdd>{},
+        "x", sel::Field<decltype(&Foo::x), &Foo::x>{},
+        "y", sel::Field<decltype(&Foo::y), &Foo::y>{});
+    state["foo_instance"]["set_x"](4);
+    const int answer = state["foo_instance"]["double_add"](3);
+    const int x = state["foo_instance"]["x"]();
+    const int y = state["foo_instance"]["y"]();
+    state("tmp = foo_instance.set_y == nil");
+    return answer == 14 && x == 4 && foo_instance.x == 4 && y == 3 && state["tmp"];
+}
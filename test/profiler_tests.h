@@ -0,0 +1,150 @@
+#pragma once
+
+#include <chrono>
+#include <selene.h>
+#include <sstream>
+#include <string>
+
+static const char *profiler_script =
+    "function busy(n)\n"
+    "  local s = 0\n"
+    "  for i = 1, n do s = s + i % 7 end\n"
+    "  return s\n"
+    "end\n"
+    "function outer() return call_back(function() return busy(3000000) end) end\n"
+    "function outer_static()\n"
+    "  return call_static(function() return busy(3000000) end)\n"
+    "end\n";
+
+bool test_profiler_samples_lua(sel::State &state) {
+    state(profiler_script);
+    state.StartProfiler(std::chrono::microseconds{100});
+    state["busy"](3000000);
+    state.StopProfiler();
+    std::stringstream profile;
+    state.WriteProfile(profile);
+    // busy is defined on line 1 and called from C, so it has no name
+    return profile.str().find("\"]:1 ") != std::string::npos;
+}
+
+bool test_profiler_binding_frames(sel::State &state) {
+    state(profiler_script);
+    state["call_back"] = [](sel::function<int()> fun) {
+        return fun();
+    };
+    state.StartProfiler(std::chrono::microseconds{100});
+    state["outer"]();
+    state.StopProfiler();
+    std::stringstream profile;
+    state.WriteProfile(profile);
+    return profile.str().find("call_back@[C++];") != std::string::npos;
+}
+
+static int call_static(sel::function<int()> fun) {
+    return fun();
+}
+
+bool test_profiler_static_binding_frames(sel::State &state) {
+    state(profiler_script);
+    state["call_static"] = sel::Fn<decltype(&call_static), &call_static>{};
+    state.StartProfiler(std::chrono::microseconds{100});
+    state["outer_static"]();
+    state.StopProfiler();
+    std::stringstream profile;
+    state.WriteProfile(profile);
+    return profile.str().find("call_static@[C++];") != std::string::npos;
+}
+
+bool test_profiler_stopped(sel::State &state) {
+    state(profiler_script);
+    state.StartProfiler(std::chrono::microseconds{100});
+    state.StopProfiler();
+    state["busy"](3000000);
+    std::stringstream profile;
+    state.WriteProfile(profile);
+    return profile.str().empty();
+}
+
+static int user_hook_calls;
+
+static void user_hook(lua_State *, lua_Debug *) {
+    ++user_hook_calls;
+}
+
+bool test_profiler_keeps_user_hook(sel::State &) {
+    lua_State *l = luaL_newstate();
+    luaL_openlibs(l);
+    bool ok;
+    {
+        sel::State state{l};
+        state(profiler_script);
+        lua_sethook(l, &user_hook, LUA_MASKCALL, 0);
+        state.StartProfiler(std::chrono::microseconds{100});
+        state["busy"](3000000);
+        state.StopProfiler();
+        std::stringstream profile;
+        state.WriteProfile(profile);
+        ok = !profile.str().empty() && lua_gethook(l) == &user_hook
+            && lua_gethookmask(l) == LUA_MASKCALL;
+        user_hook_calls = 0;
+        state["busy"](10);
+        ok = ok && user_hook_calls > 0;
+        lua_sethook(l, nullptr, 0, 0);
+    }
+    lua_close(l);
+    return ok;
+}
+
+#ifdef SELENE_INSTRUMENT
+struct Counter {
+    int n = 0;
+    int Inc() { return ++n; }
+};
+
+static const sel::BindingStats *find_stats(
+    const std::vector<sel::BindingStats> &stats, const std::string &name) {
+    for (const auto &s : stats) {
+        if (s.name == name) return &s;
+    }
+    return nullptr;
+}
+
+bool test_binding_stats_function(sel::State &state) {
+    state["c_add"] = [](int a, int b) { return a + b; };
+    state("for i = 1, 10 do c_add(i, i) end");
+    auto stats = state.GetBindingStats();
+    const sel::BindingStats *add = find_stats(stats, "c_add");
+    std::uint64_t histogram_total = 0;
+    if (add != nullptr) {
+        for (const auto &bucket : add->histogram) histogram_total += bucket.second;
+    }
+    return add != nullptr && add->calls == 10 && histogram_total == 10;
+}
+
+bool test_binding_stats_class(sel::State &state) {
+    state["Counter"].SetClass<Counter>("inc", &Counter::Inc);
+    state("c = Counter.new(); c:inc(); c:inc()");
+    auto stats = state.GetBindingStats();
+    const sel::BindingStats *ctor = find_stats(stats, "Counter.new");
+    const sel::BindingStats *inc = find_stats(stats, "Counter:inc");
+    std::stringstream text;
+    state.WriteBindingStats(text);
+    return ctor != nullptr && ctor->calls == 1 &&
+        inc != nullptr && inc->calls == 2 &&
+        text.str().find("Counter:inc calls=2") != std::string::npos;
+}
+
+bool test_binding_stats_reset(sel::State &state) {
+    state["c_add"] = [](int a, int b) { return a + b; };
+    state("for i = 1, 10 do c_add(i, i) end");
+    state.ResetBindingStats();
+    state("c_add(1, 2); c_add(3, 4)");
+    auto stats = state.GetBindingStats();
+    const sel::BindingStats *add = find_stats(stats, "c_add");
+    std::uint64_t histogram_total = 0;
+    if (add != nullptr) {
+        for (const auto &bucket : add->histogram) histogram_total += bucket.second;
+    }
+    return add != nullptr && add->calls == 2 && histogram_total == 2;
+}
+#endif
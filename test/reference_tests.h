@@ -58,3 +58,103 @@ bool test_call_multivalue_lua_function(sel::State &state) {
     sel::function<std::tuple<int, int>()> lua_add = state["return_two"];
     return lua_add() == std::make_tuple(1, 2);
 }
+
+bool test_batch_lua_function(sel::State &state) {
+    state("function score(a, b) if a < 0 then error('negative') end return a * b end");
+    sel::function<int(int, int)> score = state["score"];
+    std::vector<std::tuple<int, int>> items;
+    for (int i = -1; i < 100; ++i) items.emplace_back(i, 2);
+    std::vector<int> out;
+    std::vector<sel::BatchError> errors = score.Batch(items, out);
+    return out.size() == 101 && out[0] == 0 && out[1] == 0 && out[100] == 198
+        && errors.size() == 1 && errors[0].index == 0
+        && errors[0].error.message.find("negative") != std::string::npos;
+}
+
+bool test_batch_keeps_caller_stack(sel::State &) {
+    lua_State *l = luaL_newstate();
+    luaL_openlibs(l);
+    bool ok;
+    {
+        sel::State state{l};
+        state("log = {} function record(s) log[#log + 1] = s end");
+        state("function split(s) return #s, s:upper() end");
+        sel::function<void(std::string)> record = state["record"];
+        sel::function<std::tuple<int, std::string>(std::string)> split =
+            state["split"];
+        lua_pushinteger(l, 42);
+        std::tuple<std::string> words[] = {std::string{"a"}, std::string{"bc"}};
+        std::tuple<int, std::string> parts[2];
+        ok = record.Batch(words, 2).empty() && split.Batch(words, 2, parts).empty()
+            && lua_gettop(l) == 1 && lua_tointeger(l, 1) == 42
+            && std::get<0>(parts[1]) == 2 && std::get<1>(parts[1]) == "BC";
+        lua_settop(l, 0);
+        ok = ok && state["log"][2] == "bc";
+    }
+    lua_close(l);
+    return ok;
+}
+
+bool test_prepared_call(sel::State &) {
+    lua_State *l = luaL_newstate();
+    luaL_openlibs(l);
+    bool ok = true;
+    {
+        sel::State state{l};
+        state.EnableTracebacks();
+        state("function accept(n) if n == 3 then error('bad packet') end return n % 2 == 0 end");
+        sel::function<bool(int)> accept = state["accept"];
+        lua_pushliteral(l, "caller");
+        {
+            auto filter = accept.Prepare();
+            int accepted = 0;
+            for (int i = 0; i < 10; ++i) {
+                if (filter(i)) ++accepted;
+                ok = ok && lua_gettop(l) == 3;
+            }
+            ok = ok && accepted == 5
+                && state.LastError().message.find("bad packet") != std::string::npos;
+        }
+        ok = ok && lua_gettop(l) == 1 && lua_isstring(l, 1);
+        lua_settop(l, 0);
+    }
+    lua_close(l);
+    return ok;
+}
+
+bool test_prepared_call_inside_binding(sel::State &) {
+    lua_State *l = luaL_newstate();
+    luaL_openlibs(l);
+    bool ok = true;
+    {
+        sel::State state{l};
+        state("function inc(n) return n + 1 end");
+        sel::function<int(int)> inc = state["inc"];
+        auto call = inc.Prepare();
+        // The binding's argument sits where the prepared slots would be
+        state["via"] = [&call](int x) { return call(x); };
+        state("r = via(41)");
+        ok = state["r"] == 42;
+        ok = ok && call(1) == 2;
+        // Values pushed by the caller above the slots stay on top and
+        // are not buried under new ones
+        const int top = lua_gettop(l);
+        lua_pushinteger(l, 7);
+        ok = ok && call(2) == 3 && call(3) == 4 && lua_gettop(l) == top + 1
+            && lua_tointeger(l, -1) == 7;
+        lua_pop(l, 1);
+        ok = ok && call(4) == 5 && lua_gettop(l) == top;
+    }
+    ok = ok && lua_gettop(l) == 0;
+    lua_close(l);
+    return ok;
+}
+
+bool test_prepared_call_after_stack_reset(sel::State &state) {
+    state("function pair(a) return a, a * 2 end");
+    sel::function<std::tuple<int, int>(int)> pair = state["pair"];
+    auto call = pair.Prepare();
+    bool first = call(1) == std::make_tuple(1, 2);
+    state["x"] = 5; // clears the stack
+    return first && call(state["x"]) == std::make_tuple(5, 10);
+}